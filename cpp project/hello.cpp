@@ -1,10 +1,65 @@
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <vector>
 #include <string>
 #include <ctime>
 #include <algorithm>
+#include <atomic>
 #include <queue>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <future>
+#include <thread>
+#include <map>
+#include <memory>
+#include <optional>
+#include <unordered_map>
 #include <stdexcept>
+#include <exception>
+#include <chrono>
+#include <random>
+#include <iomanip>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cmath>
+#include <limits>
+#include <functional>
+#include <new>
+#include <iterator>
+#include <array>
+#include <utility>
+#include <cstddef>
+#include <type_traits>
+#include <cstring>
+#include <charconv>
+#include <filesystem>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <cerrno>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#endif
 
 // Custom exception class for handling invalid input
 class InvalidArgumentException : public std::exception {
@@ -19,359 +74,7601 @@ private:
     std::string message;
 };
 
+// Fills buffer from the operating system's cryptographic random source, or throws.
+// Secrets come from here: a seeded generator such as std::mt19937_64 can be rebuilt
+// from enough of its outputs, and then predicts the rest.
+inline void secureRandom(void* buffer, size_t size) {
+    unsigned char* bytes = static_cast<unsigned char*>(buffer);
+#if defined(_WIN32)
+    std::random_device device; // rand_s on Windows, which is a CSPRNG
+    for (size_t i = 0; i < size; ++i) {
+        bytes[i] = static_cast<unsigned char>(device());
+    }
+#elif defined(__linux__)
+    while (size > 0) {
+        ssize_t got = getrandom(bytes, size, 0);
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("getrandom failed");
+        }
+        bytes += got;
+        size -= static_cast<size_t>(got);
+    }
+#else
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("cannot open /dev/urandom");
+    }
+    while (size > 0) {
+        ssize_t got = read(fd, bytes, size);
+        if (got <= 0) {
+            close(fd);
+            throw std::runtime_error("cannot read /dev/urandom");
+        }
+        bytes += got;
+        size -= static_cast<size_t>(got);
+    }
+    close(fd);
+#endif
+}
+
+// SHA-256 (FIPS 180-4) of a byte string
+inline std::array<uint8_t, 32> sha256(const std::string& message) {
+    static const uint32_t K[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+    auto rotate = [](uint32_t x, int n) {
+        return x >> n | x << (32 - n);
+    };
+
+    std::string padded = message;
+    padded.push_back(static_cast<char>(0x80));
+    padded.append((119 - message.size() % 64) % 64, '\0');
+    uint64_t bits = static_cast<uint64_t>(message.size()) * 8;
+    for (int shift = 56; shift >= 0; shift -= 8) {
+        padded.push_back(static_cast<char>(bits >> shift));
+    }
+
+    uint32_t state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    for (size_t block = 0; block < padded.size(); block += 64) {
+        uint32_t w[64];
+        for (int t = 0; t < 16; ++t) {
+            const unsigned char* word = reinterpret_cast<const unsigned char*>(padded.data() + block + 4 * t);
+            w[t] = uint32_t(word[0]) << 24 | uint32_t(word[1]) << 16 | uint32_t(word[2]) << 8 | word[3];
+        }
+        for (int t = 16; t < 64; ++t) {
+            w[t] = w[t - 16] + (rotate(w[t - 15], 7) ^ rotate(w[t - 15], 18) ^ w[t - 15] >> 3) + w[t - 7] + (rotate(w[t - 2], 17) ^ rotate(w[t - 2], 19) ^ w[t - 2] >> 10);
+        }
+        uint32_t v[8];
+        std::copy(state, state + 8, v);
+        for (int t = 0; t < 64; ++t) {
+            uint32_t t1 = v[7] + (rotate(v[4], 6) ^ rotate(v[4], 11) ^ rotate(v[4], 25)) + ((v[4] & v[5]) ^ (~v[4] & v[6])) + K[t] + w[t];
+            uint32_t t2 = (rotate(v[0], 2) ^ rotate(v[0], 13) ^ rotate(v[0], 22)) + ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+            std::copy_backward(v, v + 7, v + 8);
+            v[4] += t1;
+            v[0] = t1 + t2;
+        }
+        for (int i = 0; i < 8; ++i) {
+            state[i] += v[i];
+        }
+    }
+
+    std::array<uint8_t, 32> digest;
+    for (int i = 0; i < 32; ++i) {
+        digest[i] = static_cast<uint8_t>(state[i / 4] >> (24 - 8 * (i % 4)));
+    }
+    return digest;
+}
+
+// Compact, stable handle for a registered user; items and notifications store this instead of a User copy
+typedef uint32_t UserId;
+const UserId NO_USER = UINT32_MAX;
+
+// What a user is. Roles are bits so a command can allow several at once.
+enum Role : uint8_t {
+    NO_ROLE = 0,
+    PEOPLE_ROLE = 1 << 0,
+    RESTAURANT_ROLE = 1 << 1
+};
+typedef uint8_t RoleMask;
+const RoleMask ANY_ROLE = PEOPLE_ROLE | RESTAURANT_ROLE;
+
+// Parses a user type as signup, the log and snapshots spell it; NO_ROLE if it is neither
+inline Role roleNamed(const std::string& userType) {
+    if (userType == "people") {
+        return PEOPLE_ROLE;
+    }
+    return userType == "restaurant" ? RESTAURANT_ROLE : NO_ROLE;
+}
+
+inline const std::string& roleName(Role role) {
+    static const std::string NAMES[] = {"", "people", "restaurant"};
+    return NAMES[role];
+}
+
 class User {
 public:
+    static const size_t SALT_BYTES = 16;
+
+    // Keeps only a salted hash of password
     User(const std::string& username, const std::string& password, const std::string& userType)
-        : username(username), password(password), userType(userType) {}
+        : id(NO_USER), username(username), role(roleNamed(userType)) {
+        char salt[SALT_BYTES];
+        secureRandom(salt, sizeof(salt));
+        passwordHash.assign(salt, sizeof(salt));
+        std::array<uint8_t, 32> digest = sha256(passwordHash + password);
+        passwordHash.append(reinterpret_cast<const char*>(digest.data()), digest.size());
+    }
 
-    std::string getUsername() const {
+    // A user restored from the log or a snapshot, which only hold the hash
+    static User withPasswordHash(const std::string& username, const std::string& passwordHash, const std::string& userType) {
+        return User(username, roleNamed(userType), passwordHash);
+    }
+
+    // Assigned by UserDirectory on signup; NO_USER until then
+    UserId getId() const {
+        return id;
+    }
+
+    const std::string& getUsername() const {
         return username;
     }
 
-    std::string getPassword() const {
-        return password;
+    // The salt followed by SHA-256(salt + password); what the log and snapshots store
+    const std::string& getPasswordHash() const {
+        return passwordHash;
+    }
+
+    // Compares in time independent of where the hashes differ
+    bool checkPassword(const std::string& password) const {
+        if (passwordHash.size() != SALT_BYTES + 32) {
+            return false;
+        }
+        std::array<uint8_t, 32> digest = sha256(passwordHash.substr(0, SALT_BYTES) + password);
+        uint8_t difference = 0;
+        for (size_t i = 0; i < digest.size(); ++i) {
+            difference |= digest[i] ^ static_cast<uint8_t>(passwordHash[SALT_BYTES + i]);
+        }
+        return difference == 0;
+    }
+
+    Role getRole() const {
+        return role;
     }
 
-    std::string getUserType() const {
-        return userType;
+    // The role's name; empty for a user type signup would reject
+    const std::string& getUserType() const {
+        return roleName(role);
     }
 
 private:
+    friend class UserDirectory;
+
+    User(const std::string& username, Role role, const std::string& passwordHash)
+        : id(NO_USER), username(username), passwordHash(passwordHash), role(role) {}
+
+    UserId id;
     std::string username;
-    std::string password;
-    std::string userType;
+    std::string passwordHash;
+    Role role;
 };
 
+const time_t SECONDS_PER_HOUR = 60 * 60;
+const time_t SECONDS_PER_DAY = 24 * SECONDS_PER_HOUR;
+
 class FoodItem {
 public:
-    FoodItem(const std::string& name, int quantity, int daysToExpiration, const User& owner)
-        : name(name), quantity(quantity), daysToExpiration(daysToExpiration), owner(owner) {}
+    FoodItem(const std::string& name, int quantity, time_t expiresAt, UserId ownerId)
+        : name(name), quantity(quantity), ownerId(ownerId), expiresAt(expiresAt) {}
+
+    // Copies take the quantity as it is at that moment
+    FoodItem(const FoodItem& other)
+        : name(other.name), quantity(other.getQuantity()), ownerId(other.ownerId), expiresAt(other.expiresAt) {}
+
+    FoodItem(FoodItem&& other) noexcept
+        : name(std::move(other.name)), quantity(other.getQuantity()), ownerId(other.ownerId), expiresAt(other.expiresAt) {}
 
-    std::string getName() const {
+    FoodItem& operator=(const FoodItem& other) {
+        name = other.name;
+        quantity.store(other.getQuantity(), std::memory_order_relaxed);
+        ownerId = other.ownerId;
+        expiresAt = other.expiresAt;
+        return *this;
+    }
+
+    FoodItem& operator=(FoodItem&& other) noexcept {
+        name = std::move(other.name);
+        quantity.store(other.getQuantity(), std::memory_order_relaxed);
+        ownerId = other.ownerId;
+        expiresAt = other.expiresAt;
+        return *this;
+    }
+
+    const std::string& getName() const {
         return name;
     }
 
     int getQuantity() const {
-        return quantity;
+        return quantity.load(std::memory_order_relaxed);
+    }
+
+    // Takes up to wanted units with a compare-and-swap, so any number of threads may
+    // claim the same item at once. Returns the quantity found before the claim (0 if
+    // nothing was left); the claim took the smaller of that and wanted.
+    int claim(int wanted) {
+        int available = quantity.load(std::memory_order_relaxed);
+        while (available > 0 && !quantity.compare_exchange_weak(available, available - std::min(available, wanted), std::memory_order_relaxed)) {
+        }
+        return available;
+    }
+
+    // Absolute expiry time, so the item does not need re-dating as time passes
+    time_t getExpiresAt() const {
+        return expiresAt;
     }
 
+    // Whole days left until expiry, rounded up (0 once the item has expired)
     int getDaysToExpiration() const {
-        return daysToExpiration;
+        time_t remaining = expiresAt - time(nullptr);
+        if (remaining <= 0) {
+            return 0;
+        }
+        return static_cast<int>((remaining + SECONDS_PER_DAY - 1) / SECONDS_PER_DAY);
     }
 
-    User getOwner() const {
-        return owner;
+    UserId getOwnerId() const {
+        return ownerId;
     }
 
 private:
     std::string name;
-    int quantity;
-    int daysToExpiration;
-    User owner;
+    std::atomic<int> quantity;
+    UserId ownerId;
+    time_t expiresAt;
 };
 
 class Notification {
 public:
-    Notification(const std::string& message, const User& recipient)
-        : message(message), recipient(recipient) {}
+    Notification(const std::string& message, UserId recipientId)
+        : message(std::make_shared<const std::string>(message)), recipientId(recipientId) {}
 
-    std::string getMessage() const {
-        return message;
+    // Shares an already built message, so one event can reach many recipients without copying its text
+    Notification(std::shared_ptr<const std::string> message, UserId recipientId)
+        : message(std::move(message)), recipientId(recipientId) {}
+
+    const std::string& getMessage() const {
+        return *message;
     }
 
-    User getRecipient() const {
-        return recipient;
+    UserId getRecipientId() const {
+        return recipientId;
     }
 
 private:
-    std::string message;
-    User recipient;
-};
-
-class Restaurant : public User {
-public:
-    Restaurant(const std::string& username, const std::string& password)
-        : User(username, password, "restaurant") {}
-
-    void addFoodItem(const std::string& name, int quantity, int daysToExpiration, std::vector<FoodItem>& foodItems, std::queue<Notification>& notifications) const {
-        foodItems.emplace_back(name, quantity, daysToExpiration, *this);
-
-        // Check for expiration and send notifications
-        time_t currentTime = time(nullptr);
-        time_t expirationTime = currentTime + daysToExpiration * 24 * 60 * 60;
-
-        if (expirationTime <= currentTime) {
-            notifications.push(Notification("\033[1;31mYour " + name + " is expired!\033[0m", *this));
-        }
-    }
+    std::shared_ptr<const std::string> message;
+    UserId recipientId;
 };
 
-class FoodItemBST {
+// Bounded ring of notifications for one recipient. Any number of threads may
+// push concurrently without locks (each cell carries a sequence number that
+// producers claim with a CAS on the tail); a single consumer drains it in place.
+class Mailbox {
 private:
-    struct Node {
-        FoodItem item;
-        Node* left;
-        Node* right;
+    static const size_t CAPACITY = 64;
 
-        Node(const FoodItem& item) : item(item), left(nullptr), right(nullptr) {}
+    struct Cell {
+        std::atomic<size_t> sequence;
+        std::optional<Notification> notification;
     };
 
-    Node* root;
+    Cell cells[CAPACITY];
+    alignas(64) std::atomic<size_t> enqueuePos;
+    alignas(64) std::atomic<size_t> dequeuePos;
+    std::atomic<bool> draining;
 
-    // Helper function to insert a food item into the BST
-    Node* insert(Node* node, const FoodItem& item) {
-        if (node == nullptr) {
-            return new Node(item);
+public:
+    Mailbox() : enqueuePos(0), dequeuePos(0), draining(false) {
+        for (size_t i = 0; i < CAPACITY; ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
         }
+    }
 
-        if (item.getName() < node->item.getName()) {
-            node->left = insert(node->left, item);
-        } else if (item.getName() > node->item.getName()) {
-            node->right = insert(node->right, item);
+    Mailbox(const Mailbox&) = delete;
+    Mailbox& operator=(const Mailbox&) = delete;
+
+    // Returns false if the mailbox is full
+    bool push(Notification notification) {
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells[pos & (CAPACITY - 1)];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t lag = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (lag == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (lag < 0) {
+                return false;
+            } else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
         }
 
-        return node;
+        cell->notification.emplace(std::move(notification));
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
     }
 
-    // Helper function to perform an in-order traversal of the BST
-    void inOrderTraversal(Node* node, const User& currentUser, std::vector<FoodItem>& result) const {
-        if (node == nullptr) {
-            return;
+    // Single consumer: hands each queued notification to visit, oldest first, then frees its cell.
+    // If another session of the same recipient is already draining, returns 0 without waiting.
+    template <typename Visit>
+    size_t drain(Visit visit) {
+        if (draining.exchange(true, std::memory_order_acquire)) {
+            return 0;
         }
 
-        inOrderTraversal(node->left, currentUser, result);
-
-        if (node->item.getOwner().getUsername() == currentUser.getUsername()) {
-            result.push_back(node->item);
+        size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        size_t drained = 0;
+        while (true) {
+            Cell& cell = cells[pos & (CAPACITY - 1)];
+            if (cell.sequence.load(std::memory_order_acquire) != pos + 1) {
+                break;
+            }
+            visit(static_cast<const Notification&>(*cell.notification));
+            cell.notification.reset();
+            cell.sequence.store(pos + CAPACITY, std::memory_order_release);
+            ++pos;
+            ++drained;
         }
-
-        inOrderTraversal(node->right, currentUser, result);
+        dequeuePos.store(pos, std::memory_order_relaxed);
+        draining.store(false, std::memory_order_release);
+        return drained;
     }
 
-public:
-    FoodItemBST() : root(nullptr) {}
-
-    // Public function to insert a food item into the BST
-    void insert(const FoodItem& item) {
-        root = insert(root, item);
+    // Visits queued notifications without consuming them; only safe while no thread is draining
+    template <typename Visit>
+    void forEach(Visit visit) const {
+        for (size_t pos = dequeuePos.load(std::memory_order_relaxed);; ++pos) {
+            const Cell& cell = cells[pos & (CAPACITY - 1)];
+            if (cell.sequence.load(std::memory_order_acquire) != pos + 1) {
+                break;
+            }
+            visit(static_cast<const Notification&>(*cell.notification));
+        }
     }
 
-    // Public function to get all food items associated with a user through in-order traversal
-    std::vector<FoodItem> getFoodItems(const User& currentUser) const {
-        std::vector<FoodItem> result;
-        inOrderTraversal(root, currentUser, result);
-        return result;
+    size_t size() const {
+        return enqueuePos.load(std::memory_order_relaxed) - dequeuePos.load(std::memory_order_relaxed);
     }
 };
 
-class FoodApp {
+// Per-recipient mailboxes addressed by UserId through a two-level table of
+// atomic pointers. Mailboxes are created on first delivery, so delivering and
+// reading never touch other users' messages or take a lock.
+class NotificationCenter {
 private:
-    FoodItemBST foodItemBST; // Add a BST instance to the FoodApp
+    static const size_t CHUNK_SHIFT = 12;
+    static const size_t CHUNK_SLOTS = size_t(1) << CHUNK_SHIFT;
+    static const size_t MAX_CHUNKS = 4096;
 
-    bool loggedIn;
-    User currentUser;
-    std::queue<Notification> notifications;
-    std::vector<User> users;
-    std::vector<FoodItem> foodItems;
+    std::unique_ptr<std::atomic<std::atomic<Mailbox*>*>[]> chunks;
+    std::atomic<size_t> droppedCount;
+    std::function<void(const Notification&)> deliveryListener;
 
-public:
-    FoodApp() : loggedIn(false), currentUser("", "", "") {}
+    // Returns the slot for recipient, creating its chunk if needed, or nullptr if the id is out of range
+    std::atomic<Mailbox*>* slot(UserId recipient, bool create) const {
+        size_t chunkIndex = recipient >> CHUNK_SHIFT;
+        if (chunkIndex >= MAX_CHUNKS) {
+            return nullptr;
+        }
 
-    void run() {
-        while (true) {
-            try {
-                if (!loggedIn) {
-                    handleLoginSignup();
-                } else {
-                    handleUserActions();
-                }
-            } catch (const std::exception& e) {
-                std::cerr << "\033[1;31mError: " << e.what() << "\033[0m" << std::endl;
-            } catch (...) {
-                std::cerr << "\033[1;31mAn unknown error occurred.\033[0m" << std::endl;
+        std::atomic<Mailbox*>* chunk = chunks[chunkIndex].load(std::memory_order_acquire);
+        if (chunk == nullptr) {
+            if (!create) {
+                return nullptr;
+            }
+            std::atomic<Mailbox*>* fresh = new std::atomic<Mailbox*>[CHUNK_SLOTS]();
+            if (chunks[chunkIndex].compare_exchange_strong(chunk, fresh, std::memory_order_acq_rel)) {
+                chunk = fresh;
+            } else {
+                delete[] fresh;
             }
         }
+        return &chunk[recipient & (CHUNK_SLOTS - 1)];
     }
 
-private:
-    void handleLoginSignup() {
-        std::cout << "\033[1;32m1. Login\n2. Signup\n3. Exit\033[0m\nEnter your choice: ";
-        int choice;
-        std::cin >> choice;
+    Mailbox* mailbox(UserId recipient, bool create) const {
+        std::atomic<Mailbox*>* entry = slot(recipient, create);
+        if (entry == nullptr) {
+            return nullptr;
+        }
 
-        switch (choice) {
-            case 1:
-                loggedIn = login(currentUser, users);
-                break;
-            case 2:
-                signup(users);
-                break;
-            case 3:
-                exit(0);
-            default:
-                throw InvalidArgumentException("\033[1;31mInvalid choice. Try again.\033[0m");
+        Mailbox* box = entry->load(std::memory_order_acquire);
+        if (box == nullptr && create) {
+            Mailbox* fresh = new Mailbox();
+            if (entry->compare_exchange_strong(box, fresh, std::memory_order_acq_rel)) {
+                box = fresh;
+            } else {
+                delete fresh;
+            }
         }
+        return box;
     }
 
-    void handleUserActions() {
-        std::cout << "\033[1;32m1. Add Food Item (Restaurant)\n2. View Food Items (People)\n3. View Expiring Items (People)\n4. Notifications (People)\n5. Logout\033[0m\nEnter your choice: ";
-        int choice;
-        std::cin >> choice;
+public:
+    NotificationCenter() : chunks(new std::atomic<std::atomic<Mailbox*>*>[MAX_CHUNKS]()), droppedCount(0) {}
 
-        switch (choice) {
-            case 1:
-                if (currentUser.getUserType() == "restaurant") {
-                    addFoodItem(currentUser, foodItems, notifications);
-                } else {
-                    throw InvalidArgumentException("\033[1;31mOnly restaurants can add food items.\033[0m");
-                }
-                break;
-            case 2:
-                if (currentUser.getUserType() == "people") {
-                    viewFoodItems(currentUser);
-                } else {
-                    throw InvalidArgumentException("\033[1;31mOnly people can view food items.\033[0m");
-                }
-                break;
-            case 3:
-                if (currentUser.getUserType() == "people") {
-                    viewExpiringItems(currentUser);
-                } else {
-                    throw InvalidArgumentException("\033[1;31mOnly people can view expiring items.\033[0m");
-                }
-                break;
-            case 4:
-                if (currentUser.getUserType() == "people") {
-                    viewNotifications(notifications);
-                } else {
-                    throw InvalidArgumentException("\033[1;31mRestaurants cannot view notifications.\033[0m");
+    ~NotificationCenter() {
+        for (size_t c = 0; c < MAX_CHUNKS; ++c) {
+            std::atomic<Mailbox*>* chunk = chunks[c].load();
+            if (chunk != nullptr) {
+                for (size_t i = 0; i < CHUNK_SLOTS; ++i) {
+                    delete chunk[i].load();
                 }
-                break;
-            case 5:
-                loggedIn = false;
-                currentUser = User("", "", ""); // Clear user data
-                break;
-            default:
-                throw InvalidArgumentException("\033[1;31mInvalid choice. Try again.\033[0m");
+                delete[] chunk;
+            }
         }
     }
 
-    bool login(User& currentUser, std::vector<User>& users) {
-        std::string username, password;
-        std::cout << "Enter username: ";
-        std::cin >> username;
-        std::cout << "Enter password: ";
-        std::cin >> password;
+    NotificationCenter(const NotificationCenter&) = delete;
+    NotificationCenter& operator=(const NotificationCenter&) = delete;
 
-        auto it = std::find_if(users.begin(), users.end(), [username, password](const User& user) {
-            return user.getUsername() == username && user.getPassword() == password;
-        });
+    // Called after every successful delivery (e.g. to journal it); set before any producer starts
+    void setDeliveryListener(std::function<void(const Notification&)> listener) {
+        deliveryListener = std::move(listener);
+    }
 
-        if (it != users.end()) {
-            currentUser = *it; // Set the current user
-            std::cout << "\033[1;32mLogin successful. Welcome, " << username << "!\033[0m" << std::endl;
-            return true;
-        } else {
-            std::cout << "\033[1;31mLogin failed. Invalid username or password.\033[0m" << std::endl;
+    // Delivers to the notification's recipient; returns false (and counts a drop) if their mailbox is full
+    bool send(const Notification& notification) {
+        Mailbox* box = mailbox(notification.getRecipientId(), true);
+        if (box == nullptr || !box->push(notification)) {
+            droppedCount.fetch_add(1, std::memory_order_relaxed);
             return false;
         }
+        if (deliveryListener) {
+            deliveryListener(notification);
+        }
+        return true;
     }
 
-    void signup(std::vector<User>& users) {
-        std::string username, password, userType;
-        std::cout << "Enter username: ";
-        std::cin >> username;
+    // Fan-out: one event to many recipients, sharing a single copy of the message; returns how many got it
+    size_t send(const std::vector<UserId>& recipients, const std::string& message) {
+        std::shared_ptr<const std::string> shared = std::make_shared<const std::string>(message);
+        size_t delivered = 0;
+        for (UserId recipient : recipients) {
+            delivered += send(Notification(shared, recipient));
+        }
+        return delivered;
+    }
 
-        auto it = std::find_if(users.begin(), users.end(), [username](const User& user) {
-            return user.getUsername() == username;
-        });
+    // Consumes the recipient's queued notifications in place; O(their messages)
+    template <typename Visit>
+    size_t drain(UserId recipient, Visit visit) {
+        Mailbox* box = mailbox(recipient, false);
+        return box == nullptr ? 0 : box->drain(visit);
+    }
 
-        if (it != users.end()) {
-            throw InvalidArgumentException("\033[1;31mUsername is already in use. Please choose a different username.\033[0m");
-        } else {
-            std::cout << "Enter password: ";
-            std::cin >> password;
-            std::cout << "Enter user type (\033[1;34mpeople\033[0m or \033[1;34mrestaurant\033[0m): ";
-            std::cin >> userType;
+    size_t pending(UserId recipient) const {
+        Mailbox* box = mailbox(recipient, false);
+        return box == nullptr ? 0 : box->size();
+    }
 
-            if (userType == "people" || userType == "restaurant") {
-                users.emplace_back(username, password, userType);
-                std::cout << "\033[1;32mSignup successful. You can now log in.\033[0m" << std::endl;
-            } else {
-                throw InvalidArgumentException("\033[1;31mInvalid user type. Please choose 'people' or 'restaurant'.\033[0m");
+    // Notifications queued across all mailboxes; O(recipients)
+    size_t pendingTotal() const {
+        size_t total = 0;
+        for (size_t c = 0; c < MAX_CHUNKS; ++c) {
+            std::atomic<Mailbox*>* chunk = chunks[c].load(std::memory_order_acquire);
+            for (size_t i = 0; chunk != nullptr && i < CHUNK_SLOTS; ++i) {
+                Mailbox* box = chunk[i].load(std::memory_order_acquire);
+                total += box == nullptr ? 0 : box->size();
             }
         }
+        return total;
     }
 
-    void addFoodItem(const User& currentUser, std::vector<FoodItem>& foodItems, std::queue<Notification>& notifications) {
-        std::string name;
-        int quantity, daysToExpiration;
-        std::cout << "Enter food item name: ";
-        std::cin >> name;
-        if (name.empty()) {
-            throw InvalidArgumentException("\033[1;31mFood item name cannot be empty.\033[0m");
+    // Visits every queued notification without consuming it; only safe while nothing is being delivered or drained
+    template <typename Visit>
+    void forEachPending(Visit visit) const {
+        for (size_t c = 0; c < MAX_CHUNKS; ++c) {
+            std::atomic<Mailbox*>* chunk = chunks[c].load(std::memory_order_acquire);
+            for (size_t i = 0; chunk != nullptr && i < CHUNK_SLOTS; ++i) {
+                Mailbox* box = chunk[i].load(std::memory_order_acquire);
+                if (box != nullptr) {
+                    box->forEach(visit);
+                }
+            }
+        }
+    }
+
+    size_t dropped() const {
+        return droppedCount.load(std::memory_order_relaxed);
+    }
+};
+
+// Keyword alerts ("tell me when anyone lists rice or bread"). An inverted index
+// maps each keyword to the ascending ids of its subscribers, so matching a new
+// listing costs one hash lookup per word of its name plus the subscribers found,
+// however many subscriptions exist. Keywords and name words are case-folded runs
+// of letters and digits ("Chicken_Soup" has the words "chicken" and "soup").
+class SubscriptionIndex {
+private:
+    mutable std::shared_mutex lock;
+    std::unordered_map<std::string, std::vector<UserId>> subscribers;
+    std::unordered_map<UserId, std::vector<std::string>> keywordsOf;
+    size_t subscriptionCount;
+
+public:
+    static const size_t MAX_KEYWORD_LENGTH = 32;
+    static const size_t MAX_KEYWORDS_PER_USER = 32;
+
+    SubscriptionIndex() : subscriptionCount(0) {}
+
+    SubscriptionIndex(const SubscriptionIndex&) = delete;
+    SubscriptionIndex& operator=(const SubscriptionIndex&) = delete;
+
+    // Hands each folded word of text to visit, in order
+    template <typename Visit>
+    static void forEachWord(const std::string& text, Visit visit) {
+        std::string word;
+        for (size_t i = 0; i <= text.size(); ++i) {
+            char c = i < text.size() ? text[i] : ' ';
+            if (isalnum(static_cast<unsigned char>(c))) {
+                word.push_back(static_cast<char>(tolower(static_cast<unsigned char>(c))));
+            } else if (!word.empty()) {
+                visit(word);
+                word.clear();
+            }
         }
+    }
 
-        std::cout << "Enter quantity: ";
-        std::cin >> quantity;
-        if (quantity <= 0) {
-            throw InvalidArgumentException("\033[1;31mQuantity must be greater than 0.\033[0m");
+    // The folded form of keyword, or "" if it is not a single word of letters and digits
+    static std::string normalize(const std::string& keyword) {
+        std::string folded;
+        if (keyword.empty() || keyword.size() > MAX_KEYWORD_LENGTH) {
+            return folded;
+        }
+        for (char c : keyword) {
+            if (!isalnum(static_cast<unsigned char>(c))) {
+                return std::string();
+            }
+            folded.push_back(static_cast<char>(tolower(static_cast<unsigned char>(c))));
         }
+        return folded;
+    }
 
-        std::cout << "Enter days to expiration: ";
-        std::cin >> daysToExpiration;
-        if (daysToExpiration <= 0) {
-            throw InvalidArgumentException("\033[1;31mDays to expiration must be greater than 0.\033[0m");
+    // Adds a normalized keyword for userId; false if they already have it or have too many
+    bool subscribe(UserId userId, const std::string& keyword) {
+        std::unique_lock<std::shared_mutex> writing(lock);
+        std::vector<std::string>& keywords = keywordsOf[userId];
+        if (keywords.size() >= MAX_KEYWORDS_PER_USER || std::find(keywords.begin(), keywords.end(), keyword) != keywords.end()) {
+            return false;
         }
+        keywords.push_back(keyword);
 
-        if (currentUser.getUserType() == "restaurant") {
-            const Restaurant* restaurant = static_cast<const Restaurant*>(&currentUser);
-            restaurant->addFoodItem(name, quantity, daysToExpiration, foodItems, notifications);
+        std::vector<UserId>& ids = subscribers[keyword];
+        ids.insert(std::upper_bound(ids.begin(), ids.end(), userId), userId);
+        ++subscriptionCount;
+        return true;
+    }
 
-            // Insert the food item into the BST
-            foodItemBST.insert(FoodItem(name, quantity, daysToExpiration, *restaurant));
+    // Removes a normalized keyword of userId; false if they did not have it
+    bool unsubscribe(UserId userId, const std::string& keyword) {
+        std::unique_lock<std::shared_mutex> writing(lock);
+        auto owner = keywordsOf.find(userId);
+        if (owner == keywordsOf.end()) {
+            return false;
+        }
+        auto it = std::find(owner->second.begin(), owner->second.end(), keyword);
+        if (it == owner->second.end()) {
+            return false;
+        }
+        owner->second.erase(it);
 
-            std::cout << "\033[1;32mFood item added successfully.\033[0m" << std::endl;
-        } else {
-            throw InvalidArgumentException("\033[1;31mError: Only restaurants can add food items.\033[0m");
+        auto entry = subscribers.find(keyword);
+        std::vector<UserId>& ids = entry->second;
+        ids.erase(std::lower_bound(ids.begin(), ids.end(), userId));
+        if (ids.empty()) {
+            subscribers.erase(entry);
         }
+        --subscriptionCount;
+        return true;
     }
 
-    void viewFoodItems(const User& currentUser) {
-        std::vector<FoodItem> foodItems = foodItemBST.getFoodItems(currentUser);
+    std::vector<std::string> keywords(UserId userId) const {
+        std::shared_lock<std::shared_mutex> reading(lock);
+        auto owner = keywordsOf.find(userId);
+        return owner == keywordsOf.end() ? std::vector<std::string>() : owner->second;
+    }
 
-        std::cout << "\033[1;34mFood Items:\033[0m" << std::endl;
-        for (const FoodItem& item : foodItems) {
-            std::cout << "\033[1;34mName:\033[0m " << item.getName() << ", \033[1;34mQuantity:\033[0m " << item.getQuantity() << ", \033[1;34mExpiration in\033[0m " << item.getDaysToExpiration() << " days" << std::endl;
+    // Replaces matched with the subscribers of any word of name, each once, ascending
+    void match(const std::string& name, std::vector<UserId>& matched) const {
+        matched.clear();
+        size_t lists = 0;
+        std::shared_lock<std::shared_mutex> reading(lock);
+        forEachWord(name, [this, &matched, &lists](const std::string& word) {
+            auto entry = subscribers.find(word);
+            if (entry != subscribers.end()) {
+                matched.insert(matched.end(), entry->second.begin(), entry->second.end());
+                ++lists;
+            }
+        });
+        if (lists > 1) { // Several words matched (or one word twice)
+            std::sort(matched.begin(), matched.end());
+            matched.erase(std::unique(matched.begin(), matched.end()), matched.end());
         }
     }
 
-    void viewExpiringItems(const User& currentUser) {
-        std::cout << "\033[1;34mExpiring Food Items:\033[0m" << std::endl;
-        time_t currentTime = time(nullptr);
+    // Visits every (user, keyword) pair; for snapshots
+    template <typename Visit>
+    void forEach(Visit visit) const {
+        std::shared_lock<std::shared_mutex> reading(lock);
+        for (const auto& owner : keywordsOf) {
+            for (const std::string& keyword : owner.second) {
+                visit(owner.first, keyword);
+            }
+        }
+    }
+
+    size_t size() const {
+        std::shared_lock<std::shared_mutex> reading(lock);
+        return subscriptionCount;
+    }
+};
+
+// A point on the map, in degrees
+struct Location {
+    double latitude;
+    double longitude;
+};
+
+// Great-circle distance in kilometres
+inline double distanceKm(const Location& a, const Location& b) {
+    const double RADIANS = 3.14159265358979323846 / 180;
+    double dLat = (b.latitude - a.latitude) * RADIANS;
+    double dLon = (b.longitude - a.longitude) * RADIANS;
+    double h = sin(dLat / 2) * sin(dLat / 2) + cos(a.latitude * RADIANS) * cos(b.latitude * RADIANS) * sin(dLon / 2) * sin(dLon / 2);
+    return 2 * 6371.0 * asin(std::min(1.0, sqrt(h)));
+}
 
-        std::vector<FoodItem> foodItems = foodItemBST.getFoodItems(currentUser);
+// Where users are. Restaurants are also bucketed into a uniform grid of
+// CELL_DEGREES squares (about 1 km), so a nearest-first walk only opens the
+// rings of cells around the origin that can still hold a closer restaurant.
+// City-scale: longitudes do not wrap at the antimeridian.
+class SpatialGrid {
+private:
+    static constexpr double CELL_DEGREES = 0.01;
+    static constexpr double KM_PER_DEGREE = 111.19; // Of latitude, and of longitude at the equator
+    static const int MAX_RINGS = 1000;              // About 10 degrees out; farther restaurants are not offered
+
+    struct Placed {
+        UserId id;
+        Location location;
+    };
+
+    mutable std::shared_mutex lock;
+    std::unordered_map<UserId, std::pair<Location, bool>> located; // Location, and whether it is in the grid
+    std::unordered_map<uint64_t, std::vector<Placed>> cells;       // Locations copied in, so a walk never leaves the cell
+    size_t gridCount;
+
+    static int32_t cellIndex(double degrees) {
+        return static_cast<int32_t>(floor(degrees / CELL_DEGREES));
+    }
+
+    static uint64_t cellKey(int32_t row, int32_t column) {
+        return static_cast<uint64_t>(static_cast<uint32_t>(row)) << 32 | static_cast<uint32_t>(column);
+    }
 
-        for (const FoodItem& item : foodItems) {
-            time_t expirationTime = currentTime + item.getDaysToExpiration() * 24 * 60 * 60;
-            if (expirationTime <= currentTime) {
-                std::cout << "\033[1;34mName:\033[0m " << item.getName() << ", \033[1;34mQuantity:\033[0m " << item.getQuantity() << ", \033[1;34mExpiration in\033[0m " << item.getDaysToExpiration() << " days" << std::endl;
+public:
+    SpatialGrid() : gridCount(0) {}
+
+    static bool valid(const Location& location) {
+        return location.latitude >= -90 && location.latitude <= 90 && location.longitude >= -180 && location.longitude <= 180;
+    }
+
+    // Records where userId is; inGrid users (restaurants) can be found by forEachNearest
+    void place(UserId userId, const Location& location, bool inGrid) {
+        std::unique_lock<std::shared_mutex> writing(lock);
+        auto previous = located.find(userId);
+        if (previous != located.end() && previous->second.second) {
+            const Location& old = previous->second.first;
+            auto cell = cells.find(cellKey(cellIndex(old.latitude), cellIndex(old.longitude)));
+            cell->second.erase(std::find_if(cell->second.begin(), cell->second.end(), [userId](const Placed& placed) {
+                return placed.id == userId;
+            }));
+            if (cell->second.empty()) {
+                cells.erase(cell);
             }
+            --gridCount;
+        }
+        located[userId] = std::make_pair(location, inGrid);
+        if (inGrid) {
+            cells[cellKey(cellIndex(location.latitude), cellIndex(location.longitude))].push_back(Placed{userId, location});
+            ++gridCount;
         }
     }
 
-    void viewNotifications(std::queue<Notification>& notifications) {
-        std::cout << "\033[1;34mNotifications:\033[0m" << std::endl;
-        while (!notifications.empty()) {
-            Notification notification = notifications.front();
-            std::cout << "\033[1;34mMessage:\033[0m " << notification.getMessage() << ", \033[1;34mRecipient:\033[0m " << notification.getRecipient().getUsername() << std::endl;
-            notifications.pop();
+    bool find(UserId userId, Location& location) const {
+        std::shared_lock<std::shared_mutex> reading(lock);
+        auto entry = located.find(userId);
+        if (entry == located.end()) {
+            return false;
+        }
+        location = entry->second.first;
+        return true;
+    }
+
+    // Hands grid users to visit(id, km) nearest first until it returns false. Cells
+    // are opened ring by ring; a candidate is handed out once no unopened ring can
+    // hold anything closer. visit runs under the grid's read lock.
+    template <typename Visit>
+    void forEachNearest(const Location& origin, Visit visit) const {
+        typedef std::pair<double, UserId> Candidate;
+        std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> candidates;
+
+        std::shared_lock<std::shared_mutex> reading(lock);
+        size_t unopened = gridCount;
+
+        const double RADIANS = 3.14159265358979323846 / 180;
+        int32_t row = cellIndex(origin.latitude), column = cellIndex(origin.longitude);
+        for (int ring = 0; ring <= MAX_RINGS && (unopened > 0 || !candidates.empty()); ++ring) {
+            for (int32_t r = row - ring; r <= row + ring && unopened > 0; ++r) {
+                bool edgeRow = r == row - ring || r == row + ring;
+                for (int32_t c = column - ring; c <= column + ring; c += edgeRow || ring == 0 ? 1 : 2 * ring) {
+                    auto cell = cells.find(cellKey(r, c));
+                    if (cell == cells.end()) {
+                        continue;
+                    }
+                    for (const Placed& placed : cell->second) {
+                        candidates.emplace(distanceKm(origin, placed.location), placed.id);
+                    }
+                    unopened -= cell->second.size();
+                }
+            }
+
+            // Unopened cells are more than ring cell widths away, measured in the narrower
+            // (east-west) direction at the most poleward latitude the next ring reaches
+            double poleward = std::min(fabs(origin.latitude) + (ring + 1) * CELL_DEGREES, 90.0);
+            double cellKm = CELL_DEGREES * KM_PER_DEGREE * std::max(cos(poleward * RADIANS), 0.001);
+            double closestUnopened = unopened == 0 ? std::numeric_limits<double>::infinity() : ring * cellKm;
+            while (!candidates.empty() && candidates.top().first <= closestUnopened) {
+                Candidate nearest = candidates.top();
+                candidates.pop();
+                if (!visit(nearest.second, nearest.first)) {
+                    return;
+                }
+            }
+        }
+    }
+
+    // Visits every (user, location); for snapshots
+    template <typename Visit>
+    void forEach(Visit visit) const {
+        std::shared_lock<std::shared_mutex> reading(lock);
+        for (const auto& entry : located) {
+            visit(entry.first, entry.second.first);
+        }
+    }
+
+    size_t size() const {
+        std::shared_lock<std::shared_mutex> reading(lock);
+        return located.size();
+    }
+};
+
+// User registry: accounts are interned into dense UserIds (their index in the
+// account list) with O(1) lookup by username through an open-addressing
+// (linear probing) table. Each slot caches the username hash, so probes only
+// compare strings when the hashes match. Lookups share a reader lock and
+// signups take it exclusively; accounts live in a deque, so returned
+// pointers stay valid as the directory grows.
+class UserDirectory {
+private:
+    static const uint32_t EMPTY_SLOT = UINT32_MAX;
+
+    struct Slot {
+        size_t hash;
+        uint32_t userIndex;
+    };
+
+    mutable std::shared_mutex lock;
+    std::deque<User> users;
+    std::vector<Slot> slots;
+    size_t mask;
+
+    static size_t hashUsername(const std::string& username) {
+        return std::hash<std::string>()(username);
+    }
+
+    // Helper function to find the slot holding username, or the empty slot where it would go
+    size_t probe(const std::string& username, size_t hash) const {
+        size_t slot = hash & mask;
+        while (slots[slot].userIndex != EMPTY_SLOT) {
+            if (slots[slot].hash == hash && users[slots[slot].userIndex].getUsername() == username) {
+                break;
+            }
+            slot = (slot + 1) & mask;
+        }
+        return slot;
+    }
+
+    // Helper function to double the table once it is half full
+    void grow() {
+        std::vector<Slot> oldSlots(slots.size() * 2, Slot{0, EMPTY_SLOT});
+        oldSlots.swap(slots);
+        mask = slots.size() - 1;
+
+        for (const Slot& old : oldSlots) {
+            if (old.userIndex != EMPTY_SLOT) {
+                size_t slot = old.hash & mask;
+                while (slots[slot].userIndex != EMPTY_SLOT) {
+                    slot = (slot + 1) & mask;
+                }
+                slots[slot] = old;
+            }
+        }
+    }
+
+public:
+    UserDirectory() : slots(16, Slot{0, EMPTY_SLOT}), mask(15) {}
+
+    // Returns the user with this username, or nullptr
+    const User* find(const std::string& username) const {
+        size_t hash = hashUsername(username);
+        std::shared_lock<std::shared_mutex> reading(lock);
+        const Slot& slot = slots[probe(username, hash)];
+        return slot.userIndex == EMPTY_SLOT ? nullptr : &users[slot.userIndex];
+    }
+
+    const User& get(UserId id) const {
+        std::shared_lock<std::shared_mutex> reading(lock);
+        return users[id];
+    }
+
+    // Registers a new user and returns its id, or NO_USER if the username is already taken
+    UserId add(const User& user) {
+        size_t hash = hashUsername(user.getUsername());
+        std::unique_lock<std::shared_mutex> writing(lock);
+        size_t slot = probe(user.getUsername(), hash);
+        if (slots[slot].userIndex != EMPTY_SLOT) {
+            return NO_USER; // Checked before growing, so a rejected signup never rehashes
+        }
+        if ((users.size() + 1) * 2 > slots.size()) {
+            grow();
+            slot = probe(user.getUsername(), hash);
+        }
+
+        UserId id = static_cast<UserId>(users.size());
+        slots[slot] = Slot{hash, id};
+        users.push_back(user);
+        users.back().id = id;
+        return id;
+    }
+
+    size_t size() const {
+        std::shared_lock<std::shared_mutex> reading(lock);
+        return users.size();
+    }
+};
+
+// Opaque login session; 0 is never issued
+typedef uint64_t SessionToken;
+const SessionToken NO_SESSION = 0;
+
+// Sessions issued at login and resolved on every authenticated request. A token
+// is its slot index in the low bits and a secureRandom nonce above, so resolving is
+// one table index and a compare with no lock: issuing writes the slot before
+// publishing the token, and the reader re-checks the token after reading it.
+// Sessions idle for longer than idleSeconds stop resolving and their slots are
+// reused. Slots live in chunks that are never freed while the table lives.
+class SessionTable {
+private:
+    static const size_t CHUNK_SHIFT = 12;
+    static const size_t CHUNK_SLOTS = size_t(1) << CHUNK_SHIFT;
+    static const size_t MAX_CHUNKS = 4096;
+    static const size_t SLOT_BITS = 24;
+    static const size_t NONCE_BATCH = 64; // Nonces drawn per system call
+
+    struct Session {
+        std::atomic<SessionToken> token{NO_SESSION};
+        std::atomic<UserId> userId{NO_USER};
+        std::atomic<int64_t> lastActive{0};
+    };
+
+    std::unique_ptr<std::atomic<Session*>[]> chunks;
+    time_t idleSeconds;
+    std::atomic<size_t> activeCount;
+
+    std::mutex lock; // Issuing and freeing slots; never taken by resolve
+    std::vector<uint32_t> freeSlots;
+    uint32_t usedSlots;
+    uint64_t nonces[NONCE_BATCH];
+    size_t noncesLeft;
+
+    // Issued tokens always have nonce bits; NO_SESSION and other zero-nonce values would
+    // otherwise match a free slot, whose token is NO_SESSION
+    static bool issuable(SessionToken token) {
+        return token >> SLOT_BITS != 0;
+    }
+
+    // Helper function to take the next nonce; the caller holds lock
+    uint64_t nextNonce() {
+        if (noncesLeft == 0) {
+            secureRandom(nonces, sizeof(nonces));
+            noncesLeft = NONCE_BATCH;
+        }
+        return nonces[NONCE_BATCH - noncesLeft--]; // In drawing order
+    }
+
+    Session* find(SessionToken token) const {
+        uint64_t slot = token & ((uint64_t(1) << SLOT_BITS) - 1);
+        Session* chunk = chunks[slot >> CHUNK_SHIFT].load(std::memory_order_acquire);
+        return chunk == nullptr ? nullptr : &chunk[slot & (CHUNK_SLOTS - 1)];
+    }
+
+    // Helper function to end a session; only the caller that clears the token frees the slot
+    bool end(Session& session, SessionToken token) {
+        if (!issuable(token) || !session.token.compare_exchange_strong(token, NO_SESSION, std::memory_order_acq_rel)) {
+            return false;
+        }
+        activeCount.fetch_sub(1, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> guard(lock);
+        freeSlots.push_back(static_cast<uint32_t>(token & ((uint64_t(1) << SLOT_BITS) - 1)));
+        return true;
+    }
+
+public:
+    explicit SessionTable(time_t idleSeconds)
+        : chunks(new std::atomic<Session*>[MAX_CHUNKS]()), idleSeconds(idleSeconds), activeCount(0), usedSlots(0), noncesLeft(0) {}
+
+    ~SessionTable() {
+        for (size_t c = 0; c < MAX_CHUNKS; ++c) {
+            delete[] chunks[c].load();
+        }
+    }
+
+    SessionTable(const SessionTable&) = delete;
+    SessionTable& operator=(const SessionTable&) = delete;
+
+    SessionToken issue(UserId userId, time_t now) {
+        std::unique_lock<std::mutex> guard(lock);
+        if (freeSlots.empty() && usedSlots == MAX_CHUNKS * CHUNK_SLOTS) {
+            guard.unlock();
+            sweep(now);
+            guard.lock();
+            if (freeSlots.empty()) {
+                throw std::runtime_error("too many open sessions");
+            }
+        }
+
+        uint64_t nonce; // Drawn first, so a failing random source leaks no slot
+        do {
+            nonce = nextNonce() << SLOT_BITS;
+        } while (!issuable(nonce));
+
+        uint32_t slot;
+        if (!freeSlots.empty()) {
+            slot = freeSlots.back();
+            freeSlots.pop_back();
+        } else {
+            slot = usedSlots++;
+            if ((slot & (CHUNK_SLOTS - 1)) == 0) {
+                chunks[slot >> CHUNK_SHIFT].store(new Session[CHUNK_SLOTS], std::memory_order_release);
+            }
+        }
+
+        SessionToken token = nonce | slot;
+
+        Session& session = *find(slot);
+        session.userId.store(userId, std::memory_order_relaxed);
+        session.lastActive.store(now, std::memory_order_relaxed);
+        session.token.store(token, std::memory_order_release);
+        activeCount.fetch_add(1, std::memory_order_relaxed);
+        return token;
+    }
+
+    // Returns the session's user and marks it active, or NO_USER if the token is unknown or idle too long
+    UserId resolve(SessionToken token, time_t now) {
+        Session* session = issuable(token) ? find(token) : nullptr;
+        if (session == nullptr || session->token.load(std::memory_order_acquire) != token) {
+            return NO_USER;
+        }
+        UserId userId = session->userId.load(std::memory_order_acquire);
+        int64_t lastActive = session->lastActive.load(std::memory_order_acquire);
+        if (session->token.load(std::memory_order_acquire) != token) {
+            return NO_USER; // Ended and reissued while we read it
+        }
+
+        if (now - lastActive > idleSeconds) {
+            end(*session, token);
+            return NO_USER;
+        }
+        if (now != lastActive) {
+            session->lastActive.store(now, std::memory_order_relaxed); // At most one store per second per session
+        }
+        return userId;
+    }
+
+    void revoke(SessionToken token) {
+        Session* session = issuable(token) ? find(token) : nullptr;
+        if (session != nullptr) {
+            end(*session, token);
+        }
+    }
+
+    // Ends every idle session; returns how many
+    size_t sweep(time_t now) {
+        uint32_t slots;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            slots = usedSlots;
+        }
+        size_t ended = 0;
+        for (uint32_t slot = 0; slot < slots; ++slot) {
+            Session& session = *find(slot);
+            SessionToken token = session.token.load(std::memory_order_acquire);
+            if (token != NO_SESSION && now - session.lastActive.load(std::memory_order_relaxed) > idleSeconds) {
+                ended += end(session, token);
+            }
+        }
+        return ended;
+    }
+
+    size_t size() const {
+        return activeCount.load(std::memory_order_relaxed);
+    }
+};
+
+// Slab allocator for fixed-size index nodes. Blocks are carved from ~64 KiB
+// chunks, freed blocks are recycled through an intrusive free list, and the
+// destructor returns all memory in O(chunks) without visiting blocks. Chunks are
+// chained through a header of their own, so each one costs exactly one heap call.
+class NodePool {
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    struct alignas(std::max_align_t) ChunkHeader {
+        ChunkHeader* next;
+    };
+
+    static const size_t CHUNK_BYTES = 64 * 1024;
+
+    size_t blockSize;
+    size_t blocksPerChunk;
+    ChunkHeader* chunks;
+    size_t chunkCount;
+    FreeBlock* freeList;
+    char* bump;
+    char* bumpEnd;
+    size_t liveBlocks;
+
+public:
+    explicit NodePool(size_t size)
+        : blockSize((std::max(size, sizeof(FreeBlock)) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t)),
+          blocksPerChunk(std::max<size_t>(1, (CHUNK_BYTES - sizeof(ChunkHeader)) / blockSize)),
+          chunks(nullptr), chunkCount(0), freeList(nullptr), bump(nullptr), bumpEnd(nullptr), liveBlocks(0) {}
+
+    ~NodePool() {
+        while (chunks != nullptr) {
+            ChunkHeader* next = chunks->next;
+            ::operator delete(chunks);
+            chunks = next;
+        }
+    }
+
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+
+    void* allocate() {
+        ++liveBlocks;
+        if (freeList != nullptr) {
+            FreeBlock* block = freeList;
+            freeList = block->next;
+            return block;
+        }
+
+        if (bump == bumpEnd) {
+            ChunkHeader* chunk = static_cast<ChunkHeader*>(::operator new(sizeof(ChunkHeader) + blockSize * blocksPerChunk));
+            chunk->next = chunks;
+            chunks = chunk;
+            ++chunkCount;
+            bump = reinterpret_cast<char*>(chunk + 1);
+            bumpEnd = bump + blockSize * blocksPerChunk;
+        }
+        void* block = bump;
+        bump += blockSize;
+        return block;
+    }
+
+    void deallocate(void* block) {
+        --liveBlocks;
+        FreeBlock* freed = static_cast<FreeBlock*>(block);
+        freed->next = freeList;
+        freeList = freed;
+    }
+
+    size_t liveCount() const {
+        return liveBlocks;
+    }
+
+    size_t chunkBlocks() const {
+        return blocksPerChunk;
+    }
+
+    // Calls made to the global allocator so far
+    size_t heapAllocations() const {
+        return chunkCount;
+    }
+};
+
+// Node allocator with the NodePool interface that goes to the global heap for every node
+class HeapNodeAllocator {
+private:
+    size_t blockSize;
+    size_t liveBlocks;
+    size_t allocations;
+
+public:
+    explicit HeapNodeAllocator(size_t size) : blockSize(size), liveBlocks(0), allocations(0) {}
+
+    void* allocate() {
+        ++liveBlocks;
+        ++allocations;
+        return ::operator new(blockSize);
+    }
+
+    void deallocate(void* block) {
+        --liveBlocks;
+        ::operator delete(block);
+    }
+
+    size_t liveCount() const {
+        return liveBlocks;
+    }
+
+    size_t heapAllocations() const {
+        return allocations;
+    }
+};
+
+// Balanced ordered multimap laid out as a B+-tree. Nodes hold NODE_KEYS keys in
+// contiguous arrays (a handful of cache lines for short-string keys) and leaves
+// are chained so range scans never revisit inner nodes. Equal keys are kept in
+// insertion order. Insertion is iterative, so sorted input cannot exhaust the stack.
+// Nodes come from NodeAllocator, by default a NodePool per node type.
+template <typename Key, typename Value, typename NodeAllocator = NodePool>
+class BPlusTree {
+private:
+    static const int NODE_KEYS = 16;
+    static const int MAX_DEPTH = 32;
+
+    struct Node {
+        bool leaf;
+        int count;
+        Key keys[NODE_KEYS];
+
+        explicit Node(bool leaf) : leaf(leaf), count(0) {}
+    };
+
+    struct Leaf : Node {
+        Value values[NODE_KEYS];
+        Leaf* next;
+
+        Leaf() : Node(true), next(nullptr) {}
+    };
+
+    struct Inner : Node {
+        Node* children[NODE_KEYS + 1];
+
+        Inner() : Node(false) {}
+    };
+
+    NodeAllocator leafAllocator;
+    NodeAllocator innerAllocator;
+    Node* root;
+    size_t itemCount;
+
+    Leaf* newLeaf() {
+        return new (leafAllocator.allocate()) Leaf();
+    }
+
+    Inner* newInner() {
+        return new (innerAllocator.allocate()) Inner();
+    }
+
+    // Index of the first key in keys[0, count) that is greater than key
+    static int upperBound(const Key* keys, int count, const Key& key) {
+        return static_cast<int>(std::upper_bound(keys, keys + count, key) - keys);
+    }
+
+    // Index of the first key in keys[0, count) that is not less than key
+    static int lowerBound(const Key* keys, int count, const Key& key) {
+        return static_cast<int>(std::lower_bound(keys, keys + count, key) - keys);
+    }
+
+    void destroy(Node* node) {
+        if (node->leaf) {
+            Leaf* leaf = static_cast<Leaf*>(node);
+            leaf->~Leaf();
+            leafAllocator.deallocate(leaf);
+            return;
+        }
+
+        Inner* inner = static_cast<Inner*>(node);
+        for (int i = 0; i <= inner->count; ++i) {
+            destroy(inner->children[i]);
+        }
+        inner->~Inner();
+        innerAllocator.deallocate(inner);
+    }
+
+    // Helper function to insert into a full leaf; returns the new right sibling and its first key
+    Leaf* splitLeaf(Leaf* leaf, int pos, const Key& key, const Value& value, Key& separator) {
+        Key keys[NODE_KEYS + 1];
+        Value values[NODE_KEYS + 1];
+        for (int i = 0, j = 0; i <= NODE_KEYS; ++i) {
+            if (i == pos) {
+                keys[i] = key;
+                values[i] = value;
+            } else {
+                keys[i] = std::move(leaf->keys[j]);
+                values[i] = std::move(leaf->values[j]);
+                ++j;
+            }
+        }
+
+        Leaf* right = newLeaf();
+        int leftCount = (NODE_KEYS + 1) / 2;
+        for (int i = 0; i < leftCount; ++i) {
+            leaf->keys[i] = std::move(keys[i]);
+            leaf->values[i] = std::move(values[i]);
+        }
+        for (int i = leftCount; i <= NODE_KEYS; ++i) {
+            right->keys[i - leftCount] = std::move(keys[i]);
+            right->values[i - leftCount] = std::move(values[i]);
+        }
+        leaf->count = leftCount;
+        right->count = NODE_KEYS + 1 - leftCount;
+
+        right->next = leaf->next;
+        leaf->next = right;
+        separator = right->keys[0];
+        return right;
+    }
+
+    // Helper function to remove entry pos of the leaf reached through path. An emptied
+    // leaf is unlinked from the chain and its parent, and so on up while parents empty.
+    void eraseAt(Leaf* leaf, int pos, Inner** path, int* slots, int depth) {
+        for (int i = pos + 1; i < leaf->count; ++i) {
+            leaf->keys[i - 1] = std::move(leaf->keys[i]);
+            leaf->values[i - 1] = std::move(leaf->values[i]);
+        }
+        --leaf->count;
+        --itemCount;
+        if (leaf->count > 0 || depth == 0) {
+            return; // The root leaf may stay empty
+        }
+
+        // The previous leaf is the rightmost one under the nearest left sibling on the path
+        int level = depth - 1;
+        while (level >= 0 && slots[level] == 0) {
+            --level;
+        }
+        if (level >= 0) {
+            Node* node = path[level]->children[slots[level] - 1];
+            while (!node->leaf) {
+                Inner* inner = static_cast<Inner*>(node);
+                node = inner->children[inner->count];
+            }
+            static_cast<Leaf*>(node)->next = leaf->next;
+        }
+        leaf->~Leaf();
+        leafAllocator.deallocate(leaf);
+
+        for (level = depth - 1; level >= 0; --level) {
+            Inner* parent = path[level];
+            int slot = slots[level];
+            if (parent->count > 0) {
+                // Drop the child and one separator next to it; the neighbours' bounds merge
+                for (int i = slot > 0 ? slot - 1 : 0; i + 1 < parent->count; ++i) {
+                    parent->keys[i] = std::move(parent->keys[i + 1]);
+                }
+                for (int i = slot; i < parent->count; ++i) {
+                    parent->children[i] = parent->children[i + 1];
+                }
+                --parent->count;
+                break;
+            }
+
+            // Its only child is gone
+            parent->~Inner();
+            innerAllocator.deallocate(parent);
+            if (level == 0) {
+                root = newLeaf();
+                return;
+            }
+        }
+
+        while (!root->leaf && root->count == 0) {
+            Inner* old = static_cast<Inner*>(root);
+            root = old->children[0];
+            old->~Inner();
+            innerAllocator.deallocate(old);
+        }
+    }
+
+    // Helper function to insert a separator and child into a full inner node; the middle key moves up
+    Inner* splitInner(Inner* inner, int pos, Key& separator, Node* child) {
+        Key keys[NODE_KEYS + 1];
+        Node* children[NODE_KEYS + 2];
+        children[0] = inner->children[0];
+        for (int i = 0, j = 0; i <= NODE_KEYS; ++i) {
+            if (i == pos) {
+                keys[i] = std::move(separator);
+                children[i + 1] = child;
+            } else {
+                keys[i] = std::move(inner->keys[j]);
+                children[i + 1] = inner->children[j + 1];
+                ++j;
+            }
+        }
+
+        Inner* right = newInner();
+        int leftCount = NODE_KEYS / 2;
+        for (int i = 0; i < leftCount; ++i) {
+            inner->keys[i] = std::move(keys[i]);
+            inner->children[i + 1] = children[i + 1];
+        }
+        separator = std::move(keys[leftCount]);
+        right->children[0] = children[leftCount + 1];
+        for (int i = leftCount + 1; i <= NODE_KEYS; ++i) {
+            right->keys[i - leftCount - 1] = std::move(keys[i]);
+            right->children[i - leftCount] = children[i + 1];
+        }
+        inner->count = leftCount;
+        right->count = NODE_KEYS - leftCount;
+        return right;
+    }
+
+public:
+    class const_iterator {
+    public:
+        const_iterator(const Leaf* leaf, int index) : leaf(leaf), index(index) {
+            skipEmpty();
+        }
+
+        const Key& key() const {
+            return leaf->keys[index];
+        }
+
+        const Value& value() const {
+            return leaf->values[index];
+        }
+
+        const_iterator& operator++() {
+            ++index;
+            skipEmpty();
+            return *this;
+        }
+
+        bool operator==(const const_iterator& other) const {
+            return leaf == other.leaf && index == other.index;
+        }
+
+        bool operator!=(const const_iterator& other) const {
+            return !(*this == other);
+        }
+
+    private:
+        const Leaf* leaf;
+        int index;
+
+        // Moves past the end of a leaf (and past an empty root leaf)
+        void skipEmpty() {
+            while (leaf != nullptr && index == leaf->count) {
+                leaf = leaf->next;
+                index = 0;
+            }
+        }
+    };
+
+    BPlusTree() : leafAllocator(sizeof(Leaf)), innerAllocator(sizeof(Inner)), root(nullptr), itemCount(0) {}
+
+    ~BPlusTree() {
+        // Pooled nodes with trivially destructible contents are released chunk by chunk by the pool itself
+        bool trivialNodes = std::is_trivially_destructible<Key>::value && std::is_trivially_destructible<Value>::value;
+        if (root != nullptr && !(trivialNodes && std::is_same<NodeAllocator, NodePool>::value)) {
+            destroy(root);
+        }
+    }
+
+    BPlusTree(const BPlusTree&) = delete;
+    BPlusTree& operator=(const BPlusTree&) = delete;
+
+    void insert(const Key& key, const Value& value) {
+        if (root == nullptr) {
+            root = newLeaf();
+        }
+
+        // Descend to the leaf, remembering the path for splits
+        Inner* path[MAX_DEPTH];
+        int slots[MAX_DEPTH];
+        int depth = 0;
+        Node* node = root;
+        while (!node->leaf) {
+            Inner* inner = static_cast<Inner*>(node);
+            int slot = upperBound(inner->keys, inner->count, key);
+            path[depth] = inner;
+            slots[depth] = slot;
+            ++depth;
+            node = inner->children[slot];
+        }
+
+        ++itemCount;
+        Leaf* leaf = static_cast<Leaf*>(node);
+        int pos = upperBound(leaf->keys, leaf->count, key);
+        if (leaf->count < NODE_KEYS) {
+            for (int i = leaf->count; i > pos; --i) {
+                leaf->keys[i] = std::move(leaf->keys[i - 1]);
+                leaf->values[i] = std::move(leaf->values[i - 1]);
+            }
+            leaf->keys[pos] = key;
+            leaf->values[pos] = value;
+            ++leaf->count;
+            return;
+        }
+
+        // Split upwards until a node has room
+        Key separator;
+        Node* child = splitLeaf(leaf, pos, key, value, separator);
+        while (depth > 0) {
+            --depth;
+            Inner* parent = path[depth];
+            int slot = slots[depth];
+            if (parent->count < NODE_KEYS) {
+                for (int i = parent->count; i > slot; --i) {
+                    parent->keys[i] = std::move(parent->keys[i - 1]);
+                    parent->children[i + 1] = parent->children[i];
+                }
+                parent->keys[slot] = std::move(separator);
+                parent->children[slot + 1] = child;
+                ++parent->count;
+                return;
+            }
+            child = splitInner(parent, slot, separator, child);
+        }
+
+        Inner* newRoot = newInner();
+        newRoot->keys[0] = std::move(separator);
+        newRoot->children[0] = root;
+        newRoot->children[1] = child;
+        newRoot->count = 1;
+        root = newRoot;
+    }
+
+    // Replaces the contents with entries, which must be sorted by key. The tree
+    // is built bottom-up in O(n): leaves are filled left to right, then each
+    // inner level is laid over the one below, with node sizes spread evenly.
+    void assignSorted(const std::vector<std::pair<Key, Value>>& entries) {
+        if (root != nullptr) {
+            destroy(root);
+            root = nullptr;
+        }
+        itemCount = entries.size();
+        if (entries.empty()) {
+            return;
+        }
+
+        // Each level is a list of (node, smallest key in its subtree)
+        std::vector<std::pair<Node*, const Key*>> level;
+        size_t leafCount = (entries.size() + NODE_KEYS - 1) / NODE_KEYS;
+        Leaf* previous = nullptr;
+        for (size_t i = 0, next = 0; i < leafCount; ++i) {
+            size_t end = entries.size() * (i + 1) / leafCount;
+            Leaf* leaf = newLeaf();
+            for (; next < end; ++next) {
+                leaf->keys[leaf->count] = entries[next].first;
+                leaf->values[leaf->count] = entries[next].second;
+                ++leaf->count;
+            }
+            if (previous != nullptr) {
+                previous->next = leaf;
+            }
+            previous = leaf;
+            level.emplace_back(leaf, &leaf->keys[0]);
+        }
+
+        while (level.size() > 1) {
+            std::vector<std::pair<Node*, const Key*>> parents;
+            size_t innerCount = (level.size() + NODE_KEYS) / (NODE_KEYS + 1);
+            for (size_t i = 0, next = 0; i < innerCount; ++i) {
+                size_t end = level.size() * (i + 1) / innerCount;
+                Inner* inner = newInner();
+                parents.emplace_back(inner, level[next].second);
+                inner->children[0] = level[next++].first;
+                for (; next < end; ++next) {
+                    inner->keys[inner->count] = *level[next].second;
+                    inner->children[++inner->count] = level[next].first;
+                }
+            }
+            level.swap(parents);
+        }
+        root = level[0].first;
+    }
+
+    // Inserts entries sorted by key. A batch at least as large as the tree is
+    // merged with the existing entries and rebuilt bottom-up; smaller batches
+    // are inserted one by one. Equal keys keep existing entries first.
+    void insertSorted(std::vector<std::pair<Key, Value>> entries) {
+        if (entries.size() < itemCount) {
+            for (const auto& entry : entries) {
+                insert(entry.first, entry.second);
+            }
+            return;
+        }
+
+        if (itemCount > 0) {
+            std::vector<std::pair<Key, Value>> merged;
+            merged.reserve(itemCount + entries.size());
+            auto next = entries.begin();
+            for (auto it = begin(); it != end(); ++it) {
+                for (; next != entries.end() && next->first < it.key(); ++next) {
+                    merged.push_back(std::move(*next));
+                }
+                merged.emplace_back(it.key(), it.value());
+            }
+            std::move(next, entries.end(), std::back_inserter(merged));
+            entries.swap(merged);
+        }
+        assignSorted(entries);
+    }
+
+    // Removes the entry with this key and value; returns false if there is none.
+    // A leaf left empty is unlinked and returned to the node pool, along with any
+    // inner node left without children; nodes that only run low are not merged,
+    // so separators stay valid bounds and the tree stays balanced.
+    bool erase(const Key& key, const Value& value) {
+        if (root == nullptr) {
+            return false;
+        }
+
+        Inner* path[MAX_DEPTH];
+        int slots[MAX_DEPTH];
+        int depth = 0;
+        Node* node = root;
+        while (!node->leaf) {
+            Inner* inner = static_cast<Inner*>(node);
+            int slot = lowerBound(inner->keys, inner->count, key);
+            path[depth] = inner;
+            slots[depth] = slot;
+            ++depth;
+            node = inner->children[slot];
+        }
+
+        // Equal keys may run across several leaves; step along them with the path in step
+        Leaf* leaf = static_cast<Leaf*>(node);
+        int pos = lowerBound(leaf->keys, leaf->count, key);
+        while (true) {
+            for (; pos < leaf->count; ++pos) {
+                if (key < leaf->keys[pos]) {
+                    return false;
+                }
+                if (leaf->values[pos] == value) {
+                    eraseAt(leaf, pos, path, slots, depth);
+                    return true;
+                }
+            }
+
+            int level = depth - 1;
+            while (level >= 0 && slots[level] == path[level]->count) {
+                --level;
+            }
+            if (level < 0) {
+                return false;
+            }
+            node = path[level]->children[++slots[level]];
+            for (int d = level + 1; d < depth; ++d) {
+                path[d] = static_cast<Inner*>(node);
+                slots[d] = 0;
+                node = path[d]->children[0];
+            }
+            leaf = static_cast<Leaf*>(node);
+            pos = 0;
+        }
+    }
+
+    // First entry whose key is not less than key
+    const_iterator lowerBound(const Key& key) const {
+        if (root == nullptr) {
+            return end();
+        }
+
+        const Node* node = root;
+        while (!node->leaf) {
+            const Inner* inner = static_cast<const Inner*>(node);
+            node = inner->children[lowerBound(inner->keys, inner->count, key)];
+        }
+
+        const Leaf* leaf = static_cast<const Leaf*>(node);
+        int pos = lowerBound(leaf->keys, leaf->count, key);
+        if (pos == leaf->count) {
+            return const_iterator(leaf->next, 0);
+        }
+        return const_iterator(leaf, pos);
+    }
+
+    const_iterator begin() const {
+        if (root == nullptr) {
+            return end();
+        }
+
+        const Node* node = root;
+        while (!node->leaf) {
+            node = static_cast<const Inner*>(node)->children[0];
+        }
+        return const_iterator(static_cast<const Leaf*>(node), 0);
+    }
+
+    const_iterator end() const {
+        return const_iterator(nullptr, 0);
+    }
+
+    size_t size() const {
+        return itemCount;
+    }
+
+    size_t nodeCount() const {
+        return leafAllocator.liveCount() + innerAllocator.liveCount();
+    }
+
+    size_t heapAllocations() const {
+        return leafAllocator.heapAllocations() + innerAllocator.heapAllocations();
+    }
+};
+
+// Handle of a food item in the ItemStore; every index refers to items by handle.
+// 64 bits, since slots are never reused and a long-running store keeps churning.
+typedef uint64_t ItemHandle;
+
+// Slot array that owns every listed FoodItem. Slots live in fixed-size chunks,
+// so handles and item addresses stay valid as the store grows. A filled chunk
+// whose items have all been removed goes back to a small pool of spare chunks
+// that later chunks are taken from.
+class ItemStore {
+private:
+    static const size_t CHUNK_SHIFT = 10;
+    static const size_t CHUNK_SLOTS = size_t(1) << CHUNK_SHIFT;
+    static const size_t MAX_SPARE_CHUNKS = 8;
+
+public:
+    // Handles leave their top HANDLE_SPARE_BITS clear for callers that pack more into them
+    static constexpr int HANDLE_SPARE_BITS = 8;
+    static constexpr ItemHandle MAX_SLOTS = ItemHandle(1) << (64 - HANDLE_SPARE_BITS);
+
+private:
+
+    typedef std::unique_ptr<std::optional<FoodItem>[]> Chunk;
+
+    std::vector<Chunk> chunks; // Null once released
+    std::vector<uint16_t> chunkLive;
+    std::vector<Chunk> spareChunks;
+    size_t slotCount;
+    size_t liveCount;
+
+    void release(size_t chunk) {
+        if (spareChunks.size() < MAX_SPARE_CHUNKS) {
+            spareChunks.push_back(std::move(chunks[chunk]));
+        } else {
+            chunks[chunk].reset();
+        }
+    }
+
+public:
+    ItemStore() : slotCount(0), liveCount(0) {}
+
+    ItemHandle add(const FoodItem& item) {
+        if (slotCount == MAX_SLOTS) {
+            throw std::length_error("item store has used up its handles");
+        }
+        if (slotCount == chunks.size() * CHUNK_SLOTS) {
+            if (!chunks.empty() && chunkLive.back() == 0) {
+                release(chunks.size() - 1); // Filled and emptied while it was still the newest
+            }
+            if (spareChunks.empty()) {
+                chunks.emplace_back(new std::optional<FoodItem>[CHUNK_SLOTS]);
+            } else {
+                chunks.push_back(std::move(spareChunks.back()));
+                spareChunks.pop_back();
+            }
+            chunkLive.push_back(0);
+        }
+
+        ItemHandle handle = static_cast<ItemHandle>(slotCount++);
+        chunks[handle >> CHUNK_SHIFT][handle & (CHUNK_SLOTS - 1)].emplace(item);
+        ++chunkLive[handle >> CHUNK_SHIFT];
+        ++liveCount;
+        return handle;
+    }
+
+    const FoodItem& get(ItemHandle handle) const {
+        return *chunks[handle >> CHUNK_SHIFT][handle & (CHUNK_SLOTS - 1)];
+    }
+
+    FoodItem& get(ItemHandle handle) {
+        return *chunks[handle >> CHUNK_SHIFT][handle & (CHUNK_SLOTS - 1)];
+    }
+
+    bool contains(ItemHandle handle) const {
+        return handle < slotCount && chunks[handle >> CHUNK_SHIFT] && chunks[handle >> CHUNK_SHIFT][handle & (CHUNK_SLOTS - 1)].has_value();
+    }
+
+    // Frees the item's slot. Slots are never reused, so a handle names one item for
+    // the life of the store and cursors ordered by handle stay valid.
+    void remove(ItemHandle handle) {
+        size_t chunk = handle >> CHUNK_SHIFT;
+        chunks[chunk][handle & (CHUNK_SLOTS - 1)].reset();
+        --liveCount;
+        if (--chunkLive[chunk] == 0 && chunk + 1 < chunks.size()) {
+            release(chunk);
+        }
+    }
+
+    // Chunks holding items, and spare ones
+    size_t chunkCount() const {
+        return chunks.size() - static_cast<size_t>(std::count(chunks.begin(), chunks.end(), nullptr)) + spareChunks.size();
+    }
+
+    // Items currently stored
+    size_t size() const {
+        return liveCount;
+    }
+};
+
+// Secondary index ordering item handles by absolute expiry time, so "expiring
+// within the next N hours" is a range query instead of a scan of every item
+class ExpiryIndex {
+private:
+    BPlusTree<time_t, ItemHandle> handles;
+
+public:
+    typedef BPlusTree<time_t, ItemHandle>::const_iterator const_iterator;
+
+    void insert(time_t expiresAt, ItemHandle handle) {
+        handles.insert(expiresAt, handle);
+    }
+
+    void erase(time_t expiresAt, ItemHandle handle) {
+        handles.erase(expiresAt, handle);
+    }
+
+    void insertBatch(std::vector<std::pair<time_t, ItemHandle>> entries) {
+        std::stable_sort(entries.begin(), entries.end(), [](const std::pair<time_t, ItemHandle>& a, const std::pair<time_t, ItemHandle>& b) {
+            return a.first < b.first;
+        });
+        handles.insertSorted(std::move(entries));
+    }
+
+    // Handles of items expiring in [from, until], soonest first; O(log n + k)
+    std::vector<ItemHandle> getExpiring(time_t from, time_t until) const {
+        std::vector<ItemHandle> result;
+        for (auto it = handles.lowerBound(from); it != handles.end() && it.key() <= until; ++it) {
+            result.push_back(it.value());
+        }
+        return result;
+    }
+
+    // Entries in expiry order; equal times keep insertion (and so handle) order
+    const_iterator lowerBound(time_t from) const {
+        return handles.lowerBound(from);
+    }
+
+    const_iterator begin() const {
+        return handles.begin();
+    }
+
+    const_iterator end() const {
+        return handles.end();
+    }
+
+    size_t size() const {
+        return handles.size();
+    }
+};
+
+// Name search over item names, case-insensitive (ASCII). Every distinct
+// folded name gets an id and a list of its items, soonest expiry first.
+// "chick*" walks the B+-tree of distinct names from "chick"; a plain query
+// matches names containing it, found through trigram postings (name ids
+// containing each three-letter sequence) and confirmed with a find. Queries
+// shorter than three letters scan the distinct names. Results are the k
+// soonest-expiring matching items. Maintained on every insert.
+class NameSearchIndex {
+private:
+    struct Name {
+        std::string folded;
+        std::vector<std::pair<time_t, ItemHandle>> items; // Soonest first, then by handle
+    };
+
+    std::vector<Name> names;
+    BPlusTree<std::string, uint32_t> sortedNames;
+    std::unordered_map<uint32_t, std::vector<uint32_t>> trigramPostings; // Ascending name ids
+
+    static std::string fold(const std::string& name) {
+        std::string folded = name;
+        for (char& c : folded) {
+            if (c >= 'A' && c <= 'Z') {
+                c = static_cast<char>(c - 'A' + 'a');
+            }
+        }
+        return folded;
+    }
+
+    static uint32_t trigram(const std::string& text, size_t at) {
+        return static_cast<uint32_t>(static_cast<unsigned char>(text[at])) << 16 |
+               static_cast<uint32_t>(static_cast<unsigned char>(text[at + 1])) << 8 |
+               static_cast<uint32_t>(static_cast<unsigned char>(text[at + 2]));
+    }
+
+    // Id of a folded name already indexed, or NO_NAME
+    static constexpr uint32_t NO_NAME = UINT32_MAX;
+
+    uint32_t findName(const std::string& folded) const {
+        auto it = sortedNames.lowerBound(folded);
+        return it != sortedNames.end() && it.key() == folded ? it.value() : NO_NAME;
+    }
+
+    // Postings found for each position of the previous name added; names added in
+    // sorted order mostly share them, so most trigrams skip the hash lookup
+    typedef std::vector<std::pair<uint32_t, std::vector<uint32_t>*>> PostingsCache;
+
+    // Gives a new folded name the next id and its trigram postings; the caller adds it to sortedNames
+    uint32_t addName(const std::string& folded, PostingsCache& cache) {
+        uint32_t id = static_cast<uint32_t>(names.size());
+        if (cache.size() < folded.size()) {
+            cache.resize(folded.size(), std::make_pair(0, nullptr));
+        }
+        for (size_t i = 0; i + 3 <= folded.size(); ++i) {
+            uint32_t gram = trigram(folded, i);
+            if (cache[i].second == nullptr || cache[i].first != gram) {
+                cache[i] = std::make_pair(gram, &trigramPostings[gram]); // Map values stay put across rehashes
+            }
+            std::vector<uint32_t>& postings = *cache[i].second;
+            if (postings.empty() || postings.back() != id) {
+                postings.push_back(id);
+            }
+        }
+        names.push_back(Name{folded, {}});
+        return id;
+    }
+
+    uint32_t idFor(const std::string& name) {
+        std::string folded = fold(name);
+        uint32_t id = findName(folded);
+        if (id == NO_NAME) {
+            PostingsCache cache;
+            id = addName(folded, cache);
+            sortedNames.insert(folded, id);
+        }
+        return id;
+    }
+
+    // Helper function to offer a name's live items to the top-k max-heap
+    static void collect(const Name& name, time_t from, size_t k, std::vector<std::pair<time_t, ItemHandle>>& best) {
+        auto it = std::lower_bound(name.items.begin(), name.items.end(), std::make_pair(from, ItemHandle(0)));
+        for (; it != name.items.end(); ++it) {
+            if (best.size() == k) {
+                if (!(*it < best.front())) {
+                    break; // This name's later items cannot do better either
+                }
+                std::pop_heap(best.begin(), best.end());
+                best.back() = *it;
+            } else {
+                best.push_back(*it);
+            }
+            std::push_heap(best.begin(), best.end());
+        }
+    }
+
+public:
+    void insert(const std::string& name, time_t expiresAt, ItemHandle handle) {
+        std::vector<std::pair<time_t, ItemHandle>>& items = names[idFor(name)].items;
+        std::pair<time_t, ItemHandle> entry(expiresAt, handle);
+        items.insert(std::upper_bound(items.begin(), items.end(), entry), entry);
+    }
+
+    // Adds many items, given as parallel (name, handle) and (expiry, handle) lists
+    // sorted by name. Each distinct name is folded and looked up once, new names go
+    // into sortedNames as one sorted run, and each touched name's list is sorted once.
+    void insertBatch(const std::vector<std::pair<std::string, ItemHandle>>& named, const std::vector<std::pair<time_t, ItemHandle>>& expiring) {
+        // Runs of equal names; folding can reorder them ("Pie" sorts before "apple")
+        std::vector<std::pair<std::string, uint32_t>> runs;
+        std::vector<size_t> runStarts;
+        for (size_t i = 0; i < named.size(); ++i) {
+            if (i == 0 || named[i].first != named[i - 1].first) {
+                runs.emplace_back(fold(named[i].first), static_cast<uint32_t>(runs.size()));
+                runStarts.push_back(i);
+            }
+        }
+        runStarts.push_back(named.size());
+        if (!std::is_sorted(runs.begin(), runs.end())) {
+            std::sort(runs.begin(), runs.end());
+        }
+
+        std::vector<uint32_t> runIds(runs.size());
+        std::vector<std::pair<std::string, uint32_t>> added;
+        PostingsCache cache;
+        names.reserve(names.size() + runs.size());
+        bool searchTree = sortedNames.size() > 0;
+        uint32_t id = NO_NAME;
+        for (size_t r = 0; r < runs.size(); ++r) {
+            if (r == 0 || runs[r].first != runs[r - 1].first) {
+                id = searchTree ? findName(runs[r].first) : NO_NAME;
+                if (id == NO_NAME) {
+                    id = addName(runs[r].first, cache);
+                    added.emplace_back(runs[r].first, id);
+                }
+            }
+            runIds[runs[r].second] = id;
+        }
+        sortedNames.insertSorted(std::move(added));
+
+        std::vector<uint32_t> touched;
+        for (size_t i = 0, run = 0; i < named.size(); ++i) {
+            if (i == runStarts[run + 1]) {
+                ++run;
+            }
+            id = runIds[run];
+            if (!names[id].items.empty() && expiring[i] < names[id].items.back()) {
+                touched.push_back(id);
+            }
+            names[id].items.push_back(expiring[i]);
+        }
+        std::sort(touched.begin(), touched.end());
+        touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+        for (uint32_t id : touched) {
+            std::sort(names[id].items.begin(), names[id].items.end());
+        }
+    }
+
+    // Up to k items matching query that expire at or after from, soonest first
+    std::vector<std::pair<time_t, ItemHandle>> search(const std::string& query, time_t from, size_t k) const {
+        std::vector<std::pair<time_t, ItemHandle>> best;
+        std::string folded = fold(query);
+        bool prefix = !folded.empty() && folded.back() == '*';
+        if (prefix) {
+            folded.pop_back();
+        }
+        if (folded.empty() || k == 0) {
+            return best;
+        }
+
+        if (prefix) {
+            for (auto it = sortedNames.lowerBound(folded); it != sortedNames.end() && it.key().compare(0, folded.size(), folded) == 0; ++it) {
+                collect(names[it.value()], from, k, best);
+            }
+        } else if (folded.size() >= 3) {
+            // Candidates come from the rarest trigram of the query
+            const std::vector<uint32_t>* rarest = nullptr;
+            for (size_t i = 0; i + 3 <= folded.size(); ++i) {
+                auto postings = trigramPostings.find(trigram(folded, i));
+                if (postings == trigramPostings.end()) {
+                    return best;
+                }
+                if (rarest == nullptr || postings->second.size() < rarest->size()) {
+                    rarest = &postings->second;
+                }
+            }
+            for (uint32_t id : *rarest) {
+                if (folded.size() == 3 || names[id].folded.find(folded) != std::string::npos) {
+                    collect(names[id], from, k, best);
+                }
+            }
+        } else {
+            for (const Name& name : names) {
+                if (name.folded.find(folded) != std::string::npos) {
+                    collect(name, from, k, best);
+                }
+            }
+        }
+
+        std::sort_heap(best.begin(), best.end());
+        return best;
+    }
+
+    // Drops one item; its name keeps its id (and postings) for later items of that name
+    void erase(const std::string& name, time_t expiresAt, ItemHandle handle) {
+        std::string folded = fold(name);
+        auto it = sortedNames.lowerBound(folded);
+        if (it == sortedNames.end() || it.key() != folded) {
+            return;
+        }
+        std::vector<std::pair<time_t, ItemHandle>>& items = names[it.value()].items;
+        auto entry = std::lower_bound(items.begin(), items.end(), std::make_pair(expiresAt, handle));
+        if (entry != items.end() && entry->second == handle) {
+            items.erase(entry);
+        }
+    }
+
+    size_t distinctNames() const {
+        return names.size();
+    }
+};
+
+// Where a paged listing resumes: the sort key and handle of the last item handed
+// out. Owner listings use name, expiry listings expiresAt. A default cursor starts
+// at the beginning; a cursor stays valid while items are added.
+struct PageCursor {
+    bool started = false;
+    std::string name;
+    time_t expiresAt = 0;
+    ItemHandle handle = 0;
+};
+
+// Outcome of claiming units of an item: how many were taken and from which item.
+// The claim that takes the last unit empties the item, and the store removes it.
+struct Claim {
+    int taken = 0;
+    ItemHandle handle = 0;
+    time_t expiresAt = 0;
+    bool emptied = false;
+};
+
+// The single store of food items. Items live once in the ItemStore; the name
+// index (B+-tree), the per-owner index and the expiry index all hold handles.
+class FoodItemBST {
+private:
+    // Orders an owner's handles by item name, then by handle for equal names
+    struct ByName {
+        const ItemStore* items;
+
+        bool operator()(ItemHandle a, ItemHandle b) const {
+            int order = items->get(a).getName().compare(items->get(b).getName());
+            return order < 0 || (order == 0 && a < b);
+        }
+    };
+
+    ItemStore items;
+    BPlusTree<std::string, ItemHandle> nameIndex;
+    ExpiryIndex expiryIndex;
+    NameSearchIndex searchIndex;
+
+    // Secondary index: owner id -> that owner's item handles in a flat vector,
+    // ordered by name. Kept in sync on insert so listing one owner's items costs O(k).
+    std::unordered_map<UserId, std::vector<ItemHandle>> ownerIndex;
+
+public:
+    FoodItemBST() = default;
+    FoodItemBST(const FoodItemBST&) = delete;
+    FoodItemBST& operator=(const FoodItemBST&) = delete;
+
+    // Public function to insert a food item; items sharing a name (even for the same owner) are all kept
+    ItemHandle insert(const FoodItem& item) {
+        ItemHandle handle = items.add(item);
+
+        nameIndex.insert(item.getName(), handle);
+        expiryIndex.insert(item.getExpiresAt(), handle);
+        searchIndex.insert(item.getName(), item.getExpiresAt(), handle);
+        std::vector<ItemHandle>& owned = ownerIndex[item.getOwnerId()];
+        owned.insert(std::upper_bound(owned.begin(), owned.end(), handle, ByName{&items}), handle);
+        return handle;
+    }
+
+    // Public function to insert many food items at once. The batch is sorted by
+    // name (unless it already is) and each index takes it in sorted runs, so
+    // large batches are built bottom-up instead of by per-item inserts.
+    void insertBatch(std::vector<FoodItem> batch) {
+        auto byName = [](const FoodItem& a, const FoodItem& b) {
+            return a.getName() < b.getName();
+        };
+        if (!std::is_sorted(batch.begin(), batch.end(), byName)) {
+            std::stable_sort(batch.begin(), batch.end(), byName);
+        }
+
+        std::vector<std::pair<std::string, ItemHandle>> named;
+        std::vector<std::pair<time_t, ItemHandle>> expiring;
+        std::unordered_map<UserId, size_t> ownedBefore;
+        named.reserve(batch.size());
+        expiring.reserve(batch.size());
+        for (const FoodItem& item : batch) {
+            ItemHandle handle = items.add(item);
+            named.emplace_back(item.getName(), handle);
+            expiring.emplace_back(item.getExpiresAt(), handle);
+
+            std::vector<ItemHandle>& owned = ownerIndex[item.getOwnerId()];
+            ownedBefore.emplace(item.getOwnerId(), owned.size());
+            owned.push_back(handle);
+        }
+
+        // Each owner's new handles arrived in name order; merge them with the existing run
+        for (const auto& owner : ownedBefore) {
+            std::vector<ItemHandle>& owned = ownerIndex[owner.first];
+            std::inplace_merge(owned.begin(), owned.begin() + owner.second, owned.end(), ByName{&items});
+        }
+
+        searchIndex.insertBatch(named, expiring);
+        nameIndex.insertSorted(std::move(named));
+        expiryIndex.insertBatch(std::move(expiring));
+    }
+
+    const FoodItem& get(ItemHandle handle) const {
+        return items.get(handle);
+    }
+
+    // Public function to take up to wanted units of the owner's soonest-expiring item
+    // called name that expires in [from, until]. Only quantities change, by CAS, so
+    // claims may run concurrently with each other and with readers (but not with
+    // writers). An emptied item stays indexed until remove is called for it.
+    Claim claim(UserId ownerId, const std::string& name, time_t from, int wanted, time_t until = std::numeric_limits<time_t>::max()) {
+        Claim claim;
+        auto owner = ownerIndex.find(ownerId);
+        if (owner == ownerIndex.end() || wanted <= 0) {
+            return claim;
+        }
+
+        const std::vector<ItemHandle>& owned = owner->second;
+        auto first = std::lower_bound(owned.begin(), owned.end(), name, [this](ItemHandle handle, const std::string& key) {
+            return items.get(handle).getName() < key;
+        });
+        while (true) {
+            FoodItem* best = nullptr;
+            for (auto it = first; it != owned.end() && items.get(*it).getName() == name; ++it) {
+                FoodItem& item = items.get(*it);
+                if (item.getExpiresAt() >= from && item.getExpiresAt() <= until && item.getQuantity() > 0 && (best == nullptr || item.getExpiresAt() < best->getExpiresAt())) {
+                    best = &item;
+                    claim.handle = *it;
+                }
+            }
+            if (best == nullptr) {
+                return claim;
+            }
+
+            int available = best->claim(wanted);
+            if (available > 0) {
+                claim.taken = std::min(available, wanted);
+                claim.expiresAt = best->getExpiresAt();
+                claim.emptied = available <= wanted;
+                return claim;
+            }
+            // Another claimer took the last unit first; look again
+        }
+    }
+
+    // Public function to remove an item from the store and every index; false if it is already gone
+    bool remove(ItemHandle handle) {
+        if (!items.contains(handle)) {
+            return false;
+        }
+
+        const FoodItem& item = items.get(handle);
+        std::vector<ItemHandle>& owned = ownerIndex[item.getOwnerId()];
+        // The erase shifts the tail anyway; a linear find over the packed handles
+        // costs the same order and, unlike a binary search by name, touches no items
+        auto position = std::find(owned.begin(), owned.end(), handle);
+        if (position != owned.end()) {
+            owned.erase(position);
+        }
+        const std::string& name = item.getName();
+        nameIndex.erase(name, handle);
+        expiryIndex.erase(item.getExpiresAt(), handle);
+        searchIndex.erase(name, item.getExpiresAt(), handle);
+        items.remove(handle);
+        return true;
+    }
+
+    // Public function to find the owner's soonest-expiring item expiring at or after from;
+    // O(the owner's items). Returns false if they have none.
+    bool soonestExpiring(UserId ownerId, time_t from, ItemHandle& handle) const {
+        auto owner = ownerIndex.find(ownerId);
+        if (owner == ownerIndex.end()) {
+            return false;
+        }
+        bool found = false;
+        time_t soonest = 0;
+        for (ItemHandle candidate : owner->second) {
+            time_t expiresAt = items.get(candidate).getExpiresAt();
+            if (expiresAt >= from && (!found || expiresAt < soonest)) {
+                found = true;
+                soonest = expiresAt;
+                handle = candidate;
+            }
+        }
+        return found;
+    }
+
+    // Public function to remove up to limit items that expired before before, soonest
+    // first; visit sees each item just before it goes. Returns how many were removed.
+    template <typename Visit>
+    size_t removeExpired(time_t before, size_t limit, Visit visit) {
+        size_t removed = 0;
+        for (; removed < limit; ++removed) {
+            ExpiryIndex::const_iterator soonest = expiryIndex.begin();
+            if (soonest == expiryIndex.end() || soonest.key() >= before) {
+                break;
+            }
+            ItemHandle handle = soonest.value();
+            visit(items.get(handle));
+            remove(handle);
+        }
+        return removed;
+    }
+
+    size_t chunkCount() const {
+        return items.chunkCount();
+    }
+
+    // Public function to get all food items associated with a user, in name order, via the owner index
+    std::vector<FoodItem> getFoodItems(UserId ownerId) const {
+        std::vector<FoodItem> result;
+        auto owner = ownerIndex.find(ownerId);
+        if (owner == ownerIndex.end()) {
+            return result;
+        }
+
+        result.reserve(owner->second.size());
+        for (ItemHandle handle : owner->second) {
+            result.push_back(items.get(handle));
+        }
+        return result;
+    }
+
+    // Public function to stream up to limit of an owner's items, in name order, after
+    // cursor; visit gets references into the store, so nothing is copied. Advances
+    // cursor past the visited items and returns how many there were.
+    template <typename Visit>
+    size_t forEachFoodItem(UserId ownerId, PageCursor& cursor, size_t limit, Visit visit) const {
+        auto owner = ownerIndex.find(ownerId);
+        if (owner == ownerIndex.end()) {
+            return 0;
+        }
+
+        const std::vector<ItemHandle>& owned = owner->second;
+        auto it = owned.begin();
+        if (cursor.started) {
+            it = std::upper_bound(owned.begin(), owned.end(), cursor, [this](const PageCursor& after, ItemHandle handle) {
+                int order = after.name.compare(items.get(handle).getName());
+                return order < 0 || (order == 0 && after.handle < handle);
+            });
+        }
+
+        size_t visited = 0;
+        for (; it != owned.end() && visited < limit; ++it, ++visited) {
+            visit(items.get(*it));
+        }
+        if (visited > 0) {
+            cursor.started = true;
+            cursor.name = items.get(*(it - 1)).getName();
+            cursor.handle = *(it - 1);
+        }
+        return visited;
+    }
+
+    // Pull-style walk over items expiring up to until, soonest first, for callers merging several stores
+    class ExpiringScan {
+    private:
+        const ItemStore* items;
+        ExpiryIndex::const_iterator it;
+        ExpiryIndex::const_iterator end;
+        time_t until;
+
+    public:
+        ExpiringScan(const ItemStore* items, ExpiryIndex::const_iterator it, ExpiryIndex::const_iterator end, time_t until)
+            : items(items), it(it), end(end), until(until) {}
+
+        bool done() const {
+            return it == end || it.key() > until;
+        }
+
+        time_t expiresAt() const {
+            return it.key();
+        }
+
+        ItemHandle handle() const {
+            return it.value();
+        }
+
+        const FoodItem& item() const {
+            return items->get(it.value());
+        }
+
+        void next() {
+            ++it;
+        }
+    };
+
+    ExpiringScan scanExpiring(time_t from, time_t until) const {
+        return ExpiringScan(&items, expiryIndex.lowerBound(from), expiryIndex.end(), until);
+    }
+
+    // Public function to find up to k items whose name contains query ("chick*" for
+    // names starting with "chick"), expiring at or after from, soonest first
+    std::vector<std::pair<time_t, ItemHandle>> search(const std::string& query, time_t from, size_t k) const {
+        return searchIndex.search(query, from, k);
+    }
+
+    // Public function to get every listing with exactly this name, across all owners
+    std::vector<FoodItem> findByName(const std::string& name) const {
+        std::vector<FoodItem> result;
+        for (auto it = nameIndex.lowerBound(name); it != nameIndex.end() && it.key() == name; ++it) {
+            result.push_back(items.get(it.value()));
+        }
+        return result;
+    }
+
+    // Public function to visit every item in name order
+    template <typename Visit>
+    void forEachByName(Visit visit) const {
+        for (auto it = nameIndex.begin(); it != nameIndex.end(); ++it) {
+            visit(items.get(it.value()));
+        }
+    }
+
+    // Public function to get every listing expiring in [from, until], soonest first
+    std::vector<FoodItem> getExpiringItems(time_t from, time_t until) const {
+        std::vector<FoodItem> result;
+        for (ItemHandle handle : expiryIndex.getExpiring(from, until)) {
+            result.push_back(items.get(handle));
+        }
+        return result;
+    }
+
+    size_t size() const {
+        return items.size();
+    }
+};
+
+// Read-optimized copy of the items for fleet-wide reports, one array per field
+// (structure of arrays) so an aggregation streams only the columns it needs.
+// Expiry is kept as 32-bit seconds from builtAt, which makes every column four
+// bytes wide; names are interned into a dictionary and stored as ids.
+class ItemColumns {
+private:
+    time_t builtAt;
+    std::vector<int32_t> quantity;
+    std::vector<int32_t> expiresIn;
+    std::vector<UserId> ownerId;
+    std::vector<uint32_t> nameId;
+    std::vector<std::string> names;
+    std::unordered_map<std::string, uint32_t> nameIds;
+    UserId ownerBound; // One past the largest owner id
+    int32_t maxQuantity;
+
+public:
+    explicit ItemColumns(time_t builtAt) : builtAt(builtAt), ownerBound(0), maxQuantity(0) {}
+
+    void reserve(size_t rows) {
+        quantity.reserve(rows);
+        expiresIn.reserve(rows);
+        ownerId.reserve(rows);
+        nameId.reserve(rows);
+    }
+
+    // Rows arriving in name order (as the store hands them out) skip the dictionary lookup
+    void add(const std::string& name, int itemQuantity, time_t expiresAt, UserId owner) {
+        uint32_t id;
+        if (!nameId.empty() && names[nameId.back()] == name) {
+            id = nameId.back();
+        } else {
+            auto found = nameIds.find(name);
+            if (found == nameIds.end()) {
+                found = nameIds.emplace(name, static_cast<uint32_t>(names.size())).first;
+                names.push_back(name);
+            }
+            id = found->second;
+        }
+
+        time_t offset = expiresAt - builtAt;
+        quantity.push_back(itemQuantity);
+        expiresIn.push_back(static_cast<int32_t>(std::max<time_t>(INT32_MIN, std::min<time_t>(offset, INT32_MAX))));
+        ownerId.push_back(owner);
+        nameId.push_back(id);
+        ownerBound = std::max(ownerBound, owner + 1);
+        maxQuantity = std::max(maxQuantity, itemQuantity);
+    }
+
+    time_t getBuiltAt() const {
+        return builtAt;
+    }
+
+    size_t size() const {
+        return quantity.size();
+    }
+
+    const int32_t* quantities() const {
+        return quantity.data();
+    }
+
+    const int32_t* expiryOffsets() const {
+        return expiresIn.data();
+    }
+
+    const UserId* owners() const {
+        return ownerId.data();
+    }
+
+    const uint32_t* nameIdsByRow() const {
+        return nameId.data();
+    }
+
+    const std::string& name(uint32_t id) const {
+        return names[id];
+    }
+
+    size_t nameCount() const {
+        return names.size();
+    }
+
+    UserId getOwnerBound() const {
+        return ownerBound;
+    }
+
+    int32_t getMaxQuantity() const {
+        return maxQuantity;
+    }
+};
+
+// FoodItemBST shards keyed by restaurant, so sessions working on different
+// restaurants never contend. Each shard has a reader-writer lock: an insert
+// holds one shard exclusively for a single index update, and readers share it.
+// Handles carry their shard in the low bits.
+class ShardedFoodStore {
+private:
+    static const size_t SHARD_BITS = 4;
+    static const size_t SHARDS = size_t(1) << SHARD_BITS;
+    static_assert(SHARD_BITS <= ItemStore::HANDLE_SPARE_BITS, "a shard's handles must still fit once the shard is packed in");
+
+    struct Shard {
+        mutable std::shared_mutex lock;
+        FoodItemBST items;
+    };
+
+    std::unique_ptr<Shard[]> shards;
+
+    static size_t shardOf(UserId ownerId) {
+        return ownerId & (SHARDS - 1);
+    }
+
+public:
+    ShardedFoodStore() : shards(new Shard[SHARDS]) {}
+
+    ItemHandle insert(const FoodItem& item) {
+        size_t shard = shardOf(item.getOwnerId());
+        std::unique_lock<std::shared_mutex> writing(shards[shard].lock);
+        return static_cast<ItemHandle>(shards[shard].items.insert(item) << SHARD_BITS | shard);
+    }
+
+    void insertBatch(std::vector<FoodItem> batch) {
+        std::vector<FoodItem> perShard[SHARDS];
+        for (FoodItem& item : batch) {
+            perShard[shardOf(item.getOwnerId())].push_back(std::move(item));
+        }
+        for (size_t shard = 0; shard < SHARDS; ++shard) {
+            if (!perShard[shard].empty()) {
+                std::unique_lock<std::shared_mutex> writing(shards[shard].lock);
+                shards[shard].items.insertBatch(std::move(perShard[shard]));
+            }
+        }
+    }
+
+    // Claims units of an item (see FoodItemBST::claim) under the shard's read lock, so
+    // claimers on one restaurant only contend on the item's quantity. The claimer that
+    // empties the item then takes the write lock once to remove it.
+    Claim claim(UserId ownerId, const std::string& name, time_t from, int wanted, time_t until = std::numeric_limits<time_t>::max()) {
+        size_t shard = shardOf(ownerId);
+        Claim claim;
+        {
+            std::shared_lock<std::shared_mutex> reading(shards[shard].lock);
+            claim = shards[shard].items.claim(ownerId, name, from, wanted, until);
+        }
+        if (claim.emptied) {
+            std::unique_lock<std::shared_mutex> writing(shards[shard].lock);
+            shards[shard].items.remove(claim.handle);
+        }
+        claim.handle = static_cast<ItemHandle>(claim.handle << SHARD_BITS | shard);
+        return claim;
+    }
+
+    // Streams a page of one owner's items in name order; visit runs under the shard's read lock
+    template <typename Visit>
+    size_t forEachFoodItem(UserId ownerId, PageCursor& cursor, size_t limit, Visit visit) const {
+        size_t shard = shardOf(ownerId);
+        ItemHandle handle = cursor.handle;
+        cursor.handle = handle >> SHARD_BITS; // Switched to the shard's handles in place, so the cursor's name is not copied
+
+        std::shared_lock<std::shared_mutex> reading(shards[shard].lock);
+        size_t visited;
+        try {
+            visited = shards[shard].items.forEachFoodItem(ownerId, cursor, limit, visit);
+        } catch (...) {
+            cursor.handle = handle;
+            throw;
+        }
+        cursor.handle = visited > 0 ? static_cast<ItemHandle>(cursor.handle << SHARD_BITS | shard) : handle;
+        return visited;
+    }
+
+    // Streams a page of every shard's items expiring in [from, until], merged in
+    // (expiry, handle) order. All shards are read-locked while the page is built,
+    // so visit must not write to the store.
+    template <typename Visit>
+    size_t forEachExpiring(time_t from, time_t until, PageCursor& cursor, size_t limit, Visit visit) const {
+        // Fixed arrays rather than vectors, so paging allocates nothing
+        std::shared_lock<std::shared_mutex> reading[SHARDS];
+        std::optional<FoodItemBST::ExpiringScan> scans[SHARDS];
+        time_t start = cursor.started ? std::max(from, cursor.expiresAt) : from;
+        for (size_t shard = 0; shard < SHARDS; ++shard) {
+            reading[shard] = std::shared_lock<std::shared_mutex>(shards[shard].lock);
+            scans[shard].emplace(shards[shard].items.scanExpiring(start, until));
+            FoodItemBST::ExpiringScan& scan = *scans[shard];
+            while (cursor.started && !scan.done() && scan.expiresAt() == cursor.expiresAt &&
+                   (scan.handle() << SHARD_BITS | shard) <= cursor.handle) {
+                scan.next();
+            }
+        }
+
+        // Equal times go in global handle order, which each shard's run already follows
+        auto before = [&scans](size_t a, size_t b) {
+            time_t timeA = scans[a]->expiresAt(), timeB = scans[b]->expiresAt();
+            return timeA < timeB || (timeA == timeB && (scans[a]->handle() << SHARD_BITS | a) < (scans[b]->handle() << SHARD_BITS | b));
+        };
+
+        size_t visited = 0;
+        while (visited < limit) {
+            size_t soonest = SHARDS;
+            for (size_t shard = 0; shard < SHARDS; ++shard) {
+                if (!scans[shard]->done() && (soonest == SHARDS || before(shard, soonest))) {
+                    soonest = shard;
+                }
+            }
+            if (soonest == SHARDS) {
+                break;
+            }
+
+            FoodItemBST::ExpiringScan& scan = *scans[soonest];
+            visit(scan.item());
+            cursor.started = true;
+            cursor.expiresAt = scan.expiresAt();
+            cursor.handle = static_cast<ItemHandle>(scan.handle() << SHARD_BITS | soonest);
+            scan.next();
+            ++visited;
+        }
+        return visited;
+    }
+
+    // Streams the k soonest-expiring items matching query across all shards (see
+    // FoodItemBST::search); visit runs with every shard read-locked
+    template <typename Visit>
+    size_t search(const std::string& query, time_t from, size_t k, Visit visit) const {
+        std::vector<std::shared_lock<std::shared_mutex>> reading;
+        std::vector<std::pair<time_t, ItemHandle>> matches;
+        reading.reserve(SHARDS);
+        for (size_t shard = 0; shard < SHARDS; ++shard) {
+            reading.emplace_back(shards[shard].lock);
+            for (const auto& match : shards[shard].items.search(query, from, k)) {
+                matches.emplace_back(match.first, static_cast<ItemHandle>(match.second << SHARD_BITS | shard));
+            }
+        }
+
+        size_t count = std::min(k, matches.size());
+        std::partial_sort(matches.begin(), matches.begin() + count, matches.end());
+        for (size_t i = 0; i < count; ++i) {
+            ItemHandle handle = matches[i].second;
+            visit(shards[handle & (SHARDS - 1)].items.get(handle >> SHARD_BITS));
+        }
+        return count;
+    }
+
+    // Hands the owner's soonest-expiring item (expiring at or after from) to visit under
+    // the shard's read lock; false if they have none
+    template <typename Visit>
+    bool withSoonestExpiring(UserId ownerId, time_t from, Visit visit) const {
+        const Shard& shard = shards[shardOf(ownerId)];
+        std::shared_lock<std::shared_mutex> reading(shard.lock);
+        ItemHandle handle;
+        if (!shard.items.soonestExpiring(ownerId, from, handle)) {
+            return false;
+        }
+        visit(shard.items.get(handle));
+        return true;
+    }
+
+    // Removes up to limit items that expired before before, holding one shard's
+    // write lock at a time; visit runs under it. Returns how many were removed.
+    template <typename Visit>
+    size_t removeExpired(time_t before, size_t limit, Visit visit) {
+        size_t removed = 0;
+        for (size_t shard = 0; shard < SHARDS && removed < limit; ++shard) {
+            std::unique_lock<std::shared_mutex> writing(shards[shard].lock);
+            removed += shards[shard].items.removeExpired(before, limit - removed, visit);
+        }
+        return removed;
+    }
+
+    // Item chunks allocated across all shards, spares included
+    size_t chunkCount() const {
+        size_t total = 0;
+        for (size_t shard = 0; shard < SHARDS; ++shard) {
+            std::shared_lock<std::shared_mutex> reading(shards[shard].lock);
+            total += shards[shard].items.chunkCount();
+        }
+        return total;
+    }
+
+    // Copies every item into columns, holding one shard's read lock at a time. Name
+    // order lets each run of equal names share one dictionary lookup.
+    void copyColumns(ItemColumns& columns) const {
+        columns.reserve(size());
+        forEachByName([&columns](const FoodItem& item) {
+            columns.add(item.getName(), item.getQuantity(), item.getExpiresAt(), item.getOwnerId());
+        });
+    }
+
+    // Visits items shard by shard, each shard in name order
+    template <typename Visit>
+    void forEachByName(Visit visit) const {
+        for (size_t shard = 0; shard < SHARDS; ++shard) {
+            std::shared_lock<std::shared_mutex> reading(shards[shard].lock);
+            shards[shard].items.forEachByName(visit);
+        }
+    }
+
+    size_t size() const {
+        size_t total = 0;
+        for (size_t shard = 0; shard < SHARDS; ++shard) {
+            std::shared_lock<std::shared_mutex> reading(shards[shard].lock);
+            total += shards[shard].items.size();
+        }
+        return total;
+    }
+};
+
+class Restaurant : public User {
+public:
+    Restaurant(const std::string& username, const std::string& password)
+        : User(username, password, "restaurant") {}
+
+    // Lists a copy of item for its owner, whose role the caller has checked. The caller
+    // keeps using its own copy: once stored, the item can be claimed or swept by other threads.
+    static ItemHandle addFoodItem(const FoodItem& item, ShardedFoodStore& foodItems, NotificationCenter& notifications) {
+        ItemHandle handle = foodItems.insert(item);
+
+        // Check for expiration and send notifications
+        if (item.getExpiresAt() <= time(nullptr)) {
+            notifications.send(Notification("\033[1;31mYour " + item.getName() + " is expired!\033[0m", item.getOwnerId()));
+        }
+        return handle;
+    }
+};
+
+// Little-endian-host binary encoding shared by the write-ahead log and snapshots
+class BinaryWriter {
+private:
+    std::string bytes;
+
+public:
+    template <typename T>
+    void put(T value) {
+        bytes.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    void putString(const std::string& value) {
+        put(static_cast<uint32_t>(value.size()));
+        bytes.append(value);
+    }
+
+    std::string& data() {
+        return bytes;
+    }
+};
+
+class BinaryReader {
+private:
+    const char* pos;
+    const char* end;
+    bool valid;
+
+public:
+    BinaryReader(const char* data, size_t size) : pos(data), end(data + size), valid(true) {}
+
+    template <typename T>
+    T get() {
+        T value = T();
+        if (static_cast<size_t>(end - pos) < sizeof(value)) {
+            valid = false;
+            pos = end;
+            return value;
+        }
+        memcpy(&value, pos, sizeof(value));
+        pos += sizeof(value);
+        return value;
+    }
+
+    std::string getString() {
+        uint32_t size = get<uint32_t>();
+        if (static_cast<size_t>(end - pos) < size) {
+            valid = false;
+            pos = end;
+            return std::string();
+        }
+        std::string value(pos, size);
+        pos += size;
+        return value;
+    }
+
+    bool ok() const {
+        return valid;
+    }
+
+    size_t remaining() const {
+        return static_cast<size_t>(end - pos);
+    }
+};
+
+// 32-bit FNV-1a, used to detect torn or corrupt log records and snapshots.
+// Pass a previous result as seed to continue a checksum over several buffers.
+uint32_t checksum(const char* data, size_t size, uint32_t seed = 2166136261u) {
+    uint32_t hash = seed;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * 16777619u;
+    }
+    return hash;
+}
+
+// Read-only view of a whole file: memory-mapped where available, read into memory otherwise
+class MappedFile {
+private:
+    const char* bytes;
+    size_t length;
+    std::string fallback;
+
+public:
+    explicit MappedFile(const std::string& path) : bytes(nullptr), length(0) {
+#ifdef _WIN32
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            throw std::runtime_error("cannot open " + path);
+        }
+        fallback.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        bytes = fallback.data();
+        length = fallback.size();
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("cannot open " + path);
+        }
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void* mapped = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                bytes = static_cast<const char*>(mapped);
+                length = static_cast<size_t>(info.st_size);
+            }
+        }
+        close(fd);
+        if (bytes == nullptr && info.st_size > 0) {
+            throw std::runtime_error("cannot map " + path);
+        }
+#endif
+    }
+
+    ~MappedFile() {
+#ifndef _WIN32
+        if (bytes != nullptr) {
+            munmap(const_cast<char*>(bytes), length);
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const {
+        return bytes;
+    }
+
+    size_t size() const {
+        return length;
+    }
+};
+
+// Makes renames and new files in directory durable; a no-op where directories
+// cannot be synced (Windows)
+inline bool syncDirectory(const std::string& directory) {
+#ifdef _WIN32
+    (void)directory;
+    return true;
+#else
+    int fd = open(directory.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    bool synced = fsync(fd) == 0;
+    close(fd);
+    return synced;
+#endif
+}
+
+// Append-only log of state changes. Records are framed as
+// [payload length][type][payload][checksum] and buffered. commit() is a group
+// commit: the first caller writes and syncs everything buffered so far while
+// later callers wait for that sync, so concurrent actions share one fsync.
+// A failed write or sync fails the log until it is reopened: the batch may be
+// partly on disk, and a retried fsync can report success for pages the failed
+// one dropped, so no later commit may claim those records are durable.
+class WriteAheadLog {
+public:
+    enum RecordType : uint8_t {
+        PLAINTEXT_SIGNUP = 1, // Written before password hashes; replayed, never written
+        ADD_ITEM = 2,
+        NOTIFY = 3,
+        DRAIN_NOTIFICATIONS = 4,
+        CLAIM = 5,
+        SUBSCRIBE = 6,
+        UNSUBSCRIBE = 7,
+        SWEEP = 8,
+        LOCATE = 9,
+        SIGNUP = 10
+    };
+
+private:
+    static const size_t FLUSH_BYTES = 1 << 20;
+
+    std::mutex lock;
+    std::condition_variable flushed;
+    FILE* file;
+    std::string pending;
+    uint64_t appended;
+    uint64_t durable;
+    bool flushing;
+    bool failed;
+
+    static bool sync(FILE* out) {
+        if (fflush(out) != 0) {
+            return false;
+        }
+#ifdef _WIN32
+        return _commit(_fileno(out)) == 0;
+#else
+        return fsync(fileno(out)) == 0;
+#endif
+    }
+
+public:
+    WriteAheadLog() : file(nullptr), appended(0), durable(0), flushing(false), failed(false) {}
+
+    // A failed final sync cannot be thrown from here; the unsynced tail is lost as in a crash
+    ~WriteAheadLog() {
+        try {
+            close();
+        } catch (const std::exception& e) {
+            std::cerr << "\033[1;31mError: " << e.what() << "\033[0m" << std::endl;
+        }
+    }
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    void open(const std::string& path) {
+        close();
+        std::lock_guard<std::mutex> guard(lock);
+        file = fopen(path.c_str(), "ab");
+        if (file == nullptr) {
+            throw std::runtime_error("cannot open write-ahead log " + path);
+        }
+        failed = false;
+    }
+
+    // Syncs what is buffered and closes the file; it is closed even when the sync fails
+    void close() {
+        std::exception_ptr failure;
+        try {
+            commit();
+        } catch (...) {
+            failure = std::current_exception();
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (file != nullptr) {
+                fclose(file);
+                file = nullptr;
+            }
+        }
+        if (failure) {
+            std::rethrow_exception(failure);
+        }
+    }
+
+    bool isOpen() {
+        std::lock_guard<std::mutex> guard(lock);
+        return file != nullptr;
+    }
+
+    // Buffers one record; returns false when no log is open
+    bool append(RecordType type, BinaryWriter& payload) {
+        std::string& body = payload.data();
+        uint32_t length = static_cast<uint32_t>(body.size());
+        uint32_t sum = checksum(reinterpret_cast<const char*>(&type), 1);
+        sum = checksum(body.data(), body.size(), sum);
+
+        std::lock_guard<std::mutex> guard(lock);
+        if (file == nullptr) {
+            return false;
+        }
+        pending.append(reinterpret_cast<const char*>(&length), sizeof(length));
+        pending.push_back(static_cast<char>(type));
+        pending.append(body);
+        pending.append(reinterpret_cast<const char*>(&sum), sizeof(sum));
+        ++appended;
+
+        // Large batches are written as they grow; durability still waits for commit()
+        if (pending.size() >= FLUSH_BYTES && !flushing && !failed) {
+            if (fwrite(pending.data(), 1, pending.size(), file) != pending.size()) {
+                failed = true;
+                throw std::runtime_error("write-ahead log write failed");
+            }
+            pending.clear();
+        }
+        return true;
+    }
+
+    // Returns once every record appended before the call is on disk; throws if the
+    // log has failed before they got there
+    void commit() {
+        std::unique_lock<std::mutex> guard(lock);
+        uint64_t target = appended;
+        while (file != nullptr && durable < target) {
+            if (failed) {
+                throw std::runtime_error("write-ahead log failed earlier; records since then are not durable");
+            }
+            if (flushing) {
+                flushed.wait(guard);
+                continue;
+            }
+
+            // Lead this group: take everything buffered so far and sync it outside the lock
+            flushing = true;
+            std::string batch;
+            batch.swap(pending);
+            uint64_t covered = appended;
+            FILE* out = file;
+            guard.unlock();
+            bool written = (batch.empty() || fwrite(batch.data(), 1, batch.size(), out) == batch.size()) && sync(out);
+            guard.lock();
+
+            flushing = false;
+            failed = !written;
+            flushed.notify_all();
+            if (failed) {
+                throw std::runtime_error("write-ahead log sync failed");
+            }
+            durable = covered;
+        }
+    }
+
+    // Calls apply(type, reader) for each intact record in the log at path and
+    // returns the length of the intact prefix; a torn or corrupt tail is ignored.
+    template <typename Apply>
+    static size_t replay(const std::string& path, Apply apply) {
+        MappedFile log(path);
+        const char* data = log.data();
+        size_t offset = 0;
+        while (log.size() - offset >= sizeof(uint32_t) * 2 + 1) {
+            uint32_t length;
+            memcpy(&length, data + offset, sizeof(length));
+            size_t recordSize = sizeof(uint32_t) + 1 + static_cast<size_t>(length) + sizeof(uint32_t);
+            if (log.size() - offset < recordSize) {
+                break;
+            }
+
+            const char* checked = data + offset + sizeof(uint32_t);
+            uint32_t sum;
+            memcpy(&sum, checked + 1 + length, sizeof(sum));
+            if (sum != checksum(checked, 1 + length)) {
+                break;
+            }
+
+            BinaryReader payload(checked + 1, length);
+            apply(static_cast<RecordType>(static_cast<uint8_t>(checked[0])), payload);
+            offset += recordSize;
+        }
+        return offset;
+    }
+};
+
+// Commands measured by Metrics
+enum MetricCommand {
+    LOGIN_COMMAND,
+    SIGNUP_COMMAND,
+    ADD_COMMAND,
+    VIEW_COMMAND,
+    EXPIRING_COMMAND,
+    NOTIFICATIONS_COMMAND,
+    SEARCH_COMMAND,
+    CLAIM_COMMAND,
+    SUBSCRIBE_COMMAND,
+    NEARBY_COMMAND,
+    REPORT_COMMAND,
+    COMMAND_COUNT
+};
+
+// Log-linear latency histogram in the style of HdrHistogram: each power of two
+// is split into 16 buckets, so any recorded value is known to within 1/16.
+// Only the owning thread records; readers may sum it at any time.
+class LatencyHistogram {
+private:
+    static const int SUB_BITS = 4;
+    static const uint64_t SUB_BUCKETS = uint64_t(1) << SUB_BITS;
+
+public:
+    static const size_t BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    static int highestBit(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+        return 63 - __builtin_clzll(value);
+#else
+        int bit = 0;
+        while (value >>= 1) {
+            ++bit;
+        }
+        return bit;
+#endif
+    }
+
+    static size_t bucketOf(uint64_t value) {
+        if (value < SUB_BUCKETS) {
+            return static_cast<size_t>(value);
+        }
+        int shift = highestBit(value) - SUB_BITS;
+        return static_cast<size_t>((shift + 1) * SUB_BUCKETS + ((value >> shift) - SUB_BUCKETS));
+    }
+
+    // Smallest value that lands in bucket
+    static uint64_t lowestIn(size_t bucket) {
+        if (bucket < SUB_BUCKETS) {
+            return bucket;
+        }
+        int shift = static_cast<int>(bucket / SUB_BUCKETS) - 1;
+        return (SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+    }
+
+    void record(uint64_t value) {
+        std::atomic<uint64_t>& count = counts[bucketOf(value)];
+        count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); // Single writer: no locked add
+    }
+
+    void addTo(std::vector<uint64_t>& totals) const {
+        for (size_t i = 0; i < BUCKETS; ++i) {
+            totals[i] += counts[i].load(std::memory_order_relaxed);
+        }
+    }
+
+private:
+    std::atomic<uint64_t> counts[BUCKETS] = {};
+};
+
+// Process-wide per-command call counters and latency histograms. Each thread
+// records into its own shard, so the hot path never shares a cache line;
+// snapshot() sums the shards. Calls are all counted, but only one call in
+// SAMPLE_EVERY per thread and command is timed, which keeps the two clock
+// reads off most calls.
+class Metrics {
+public:
+    static const uint32_t SAMPLE_EVERY = 128;
+
+    struct Shard {
+        std::atomic<uint64_t> calls[COMMAND_COUNT] = {};
+        LatencyHistogram latency[COMMAND_COUNT];
+    };
+
+    struct Summary {
+        uint64_t calls = 0;
+        std::vector<uint64_t> latency = std::vector<uint64_t>(LatencyHistogram::BUCKETS);
+
+        // Latency at quantile q (0..1) of the timed calls, in ns; 0 if none were timed
+        uint64_t percentile(double q) const {
+            uint64_t timed = 0;
+            for (uint64_t count : latency) {
+                timed += count;
+            }
+            uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(timed));
+            uint64_t seen = 0;
+            for (size_t bucket = 0; bucket < latency.size(); ++bucket) {
+                seen += latency[bucket];
+                if (timed > 0 && seen > rank) {
+                    return LatencyHistogram::lowestIn(bucket);
+                }
+            }
+            return 0;
+        }
+    };
+
+    static const char* name(MetricCommand command) {
+        static const char* const NAMES[COMMAND_COUNT] = {"login", "signup", "add", "view", "expiring", "notifications", "search", "claim", "subscribe", "nearby", "report"};
+        return NAMES[command];
+    }
+
+    static std::atomic<bool>& enabled() {
+        static std::atomic<bool> on(true);
+        return on;
+    }
+
+    // The calling thread's shard, registered on first use and kept after the thread exits
+    static Shard& local() {
+        thread_local Shard* shard = nullptr;
+        if (shard == nullptr) {
+            shard = registerShard();
+        }
+        return *shard;
+    }
+
+    static std::vector<Summary> snapshot() {
+        std::vector<Summary> summaries(COMMAND_COUNT);
+        Registry& registry = registryInstance();
+        std::lock_guard<std::mutex> guard(registry.lock);
+        for (const std::unique_ptr<Shard>& shard : registry.shards) {
+            for (size_t command = 0; command < COMMAND_COUNT; ++command) {
+                summaries[command].calls += shard->calls[command].load(std::memory_order_relaxed);
+                shard->latency[command].addTo(summaries[command].latency);
+            }
+        }
+        return summaries;
+    }
+
+private:
+    struct Registry {
+        std::mutex lock;
+        std::vector<std::unique_ptr<Shard>> shards;
+    };
+
+    static Registry& registryInstance() {
+        static Registry registry;
+        return registry;
+    }
+
+    static Shard* registerShard() {
+        Registry& registry = registryInstance();
+        std::lock_guard<std::mutex> guard(registry.lock);
+        registry.shards.emplace_back(new Shard());
+        return registry.shards.back().get();
+    }
+};
+
+// Counts one call of a command and, if it is this thread's sampled call, times it until destruction
+class CommandTimer {
+private:
+    LatencyHistogram* histogram;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    explicit CommandTimer(MetricCommand command) : histogram(nullptr) {
+        if (!Metrics::enabled().load(std::memory_order_relaxed)) {
+            return;
+        }
+        Metrics::Shard& shard = Metrics::local();
+        uint64_t calls = shard.calls[command].load(std::memory_order_relaxed);
+        shard.calls[command].store(calls + 1, std::memory_order_relaxed);
+        if (calls % Metrics::SAMPLE_EVERY == 0) {
+            histogram = &shard.latency[command];
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~CommandTimer() {
+        if (histogram != nullptr) {
+            histogram->record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()));
+        }
+    }
+
+    CommandTimer(const CommandTimer&) = delete;
+    CommandTimer& operator=(const CommandTimer&) = delete;
+};
+
+// Output formats for item listings, chosen at startup with --format
+enum OutputFormat {
+    PLAIN_OUTPUT,    // The coloured console rows
+    JSON_OUTPUT,     // One JSON object per line
+    COLUMNAR_OUTPUT  // Binary column batches, see ItemRenderer::flush
+};
+
+// Formats listing rows into one reusable buffer and writes each batch with a
+// single write, so large listings are not dominated by per-row flushes.
+// Owner listings carry days to expiration; expiring listings add the
+// restaurant and carry hours instead.
+class ItemRenderer {
+public:
+    enum Listing : uint8_t {
+        OWNED_ITEMS = 1,
+        EXPIRING_ITEMS = 2
+    };
+
+private:
+    OutputFormat format;
+    Listing listing;
+    std::string buffer;
+    size_t rowCount;
+
+    // Columns of the batch being built in COLUMNAR_OUTPUT
+    std::vector<int32_t> quantities;
+    std::vector<int64_t> remaining;
+    std::vector<uint32_t> nameEnds;
+    std::vector<uint32_t> restaurantEnds;
+    std::string names;
+    std::string restaurants;
+
+    void appendNumber(long long value) {
+        char digits[24];
+        std::to_chars_result end = std::to_chars(digits, digits + sizeof(digits), value);
+        buffer.append(digits, end.ptr);
+    }
+
+    void appendJsonString(const std::string& value) {
+        buffer.push_back('"');
+        for (char c : value) {
+            if (c == '"' || c == '\\') {
+                buffer.push_back('\\');
+                buffer.push_back(c);
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned char>(c));
+                buffer += escaped;
+            } else {
+                buffer.push_back(c);
+            }
+        }
+        buffer.push_back('"');
+    }
+
+    template <typename T>
+    void appendColumn(const std::vector<T>& column) {
+        buffer.append(reinterpret_cast<const char*>(column.data()), column.size() * sizeof(T));
+    }
+
+    void addRow(const FoodItem& item, const std::string* restaurant, long long left) {
+        ++rowCount;
+        switch (format) {
+            case PLAIN_OUTPUT:
+                buffer += "\033[1;34mName:\033[0m ";
+                buffer += item.getName();
+                buffer += ", \033[1;34mQuantity:\033[0m ";
+                appendNumber(item.getQuantity());
+                if (restaurant != nullptr) {
+                    buffer += ", \033[1;34mRestaurant:\033[0m ";
+                    buffer += *restaurant;
+                }
+                buffer += ", \033[1;34mExpiration in\033[0m ";
+                appendNumber(left);
+                buffer += restaurant != nullptr ? " hours\n" : " days\n";
+                break;
+            case JSON_OUTPUT:
+                buffer += "{\"name\":";
+                appendJsonString(item.getName());
+                buffer += ",\"quantity\":";
+                appendNumber(item.getQuantity());
+                if (restaurant != nullptr) {
+                    buffer += ",\"restaurant\":";
+                    appendJsonString(*restaurant);
+                }
+                buffer += restaurant != nullptr ? ",\"hours\":" : ",\"days\":";
+                appendNumber(left);
+                buffer += "}\n";
+                break;
+            case COLUMNAR_OUTPUT:
+                quantities.push_back(item.getQuantity());
+                remaining.push_back(left);
+                names += item.getName();
+                nameEnds.push_back(static_cast<uint32_t>(names.size()));
+                if (restaurant != nullptr) {
+                    restaurants += *restaurant;
+                    restaurantEnds.push_back(static_cast<uint32_t>(restaurants.size()));
+                }
+                break;
+        }
+    }
+
+public:
+    ItemRenderer(OutputFormat format, Listing listing) : format(format), listing(listing), rowCount(0) {}
+
+    // Row of an owner listing
+    void add(const FoodItem& item) {
+        addRow(item, nullptr, item.getDaysToExpiration());
+    }
+
+    // Row of an expiring listing, hours counted from currentTime
+    void add(const FoodItem& item, const std::string& restaurant, time_t currentTime) {
+        addRow(item, &restaurant, static_cast<long long>((item.getExpiresAt() - currentTime) / SECONDS_PER_HOUR));
+    }
+
+    size_t rows() const {
+        return rowCount;
+    }
+
+    // Writes the batch with one write and starts a new one. A columnar batch is
+    // "FGCB", listing type (uint8), row count (uint32), then the columns:
+    // quantity (int32[rows]), days or hours left (int64[rows]), name end
+    // offsets (uint32[rows]) and name bytes, then for expiring listings
+    // restaurant end offsets and bytes. Integers are little-endian-host.
+    void flush(std::ostream& out) {
+        if (rowCount == 0) {
+            return;
+        }
+        if (format == COLUMNAR_OUTPUT) {
+            buffer.clear();
+            buffer.append("FGCB", 4);
+            buffer.push_back(static_cast<char>(listing));
+            uint32_t count = static_cast<uint32_t>(rowCount);
+            buffer.append(reinterpret_cast<const char*>(&count), sizeof(count));
+            appendColumn(quantities);
+            appendColumn(remaining);
+            appendColumn(nameEnds);
+            buffer += names;
+            if (listing == EXPIRING_ITEMS) {
+                appendColumn(restaurantEnds);
+                buffer += restaurants;
+            }
+            quantities.clear();
+            remaining.clear();
+            nameEnds.clear();
+            restaurantEnds.clear();
+            names.clear();
+            restaurants.clear();
+        }
+
+        out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        out.flush();
+        buffer.clear();
+        rowCount = 0;
+    }
+};
+
+// Fixed set of worker threads running submitted tasks in FIFO order
+class ThreadPool {
+private:
+    std::mutex lock;
+    std::condition_variable workAvailable;
+    std::condition_variable idle;
+    std::queue<std::function<void()>> tasks;
+    std::vector<std::thread> workers;
+    size_t running;
+    bool stopping;
+
+    void work() {
+        std::unique_lock<std::mutex> guard(lock);
+        while (true) {
+            workAvailable.wait(guard, [this] { return stopping || !tasks.empty(); });
+            if (tasks.empty()) {
+                return;
+            }
+
+            std::function<void()> task = std::move(tasks.front());
+            tasks.pop();
+            ++running;
+            guard.unlock();
+            try {
+                task();
+            } catch (const std::exception& e) {
+                std::cerr << "\033[1;31mError: " << e.what() << "\033[0m" << std::endl;
+            }
+            guard.lock();
+            --running;
+            if (running == 0 && tasks.empty()) {
+                idle.notify_all();
+            }
+        }
+    }
+
+public:
+    explicit ThreadPool(size_t threads) : running(0), stopping(false) {
+        for (size_t i = 0; i < std::max<size_t>(threads, 1); ++i) {
+            workers.emplace_back(&ThreadPool::work, this);
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        workAvailable.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            tasks.push(std::move(task));
+        }
+        workAvailable.notify_one();
+    }
+
+    // Blocks until every submitted task has finished
+    void waitIdle() {
+        std::unique_lock<std::mutex> guard(lock);
+        idle.wait(guard, [this] { return running == 0 && tasks.empty(); });
+    }
+
+    size_t size() const {
+        return workers.size();
+    }
+
+    // One thread per core, or one if the core count is unknown
+    static size_t hardwareThreads() {
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+};
+
+// Waste aggregates over an ItemColumns snapshot. The rows are split into one
+// range per pool thread; each range fills its own partial sums, merged at the end.
+struct WasteReport {
+    static constexpr int DAYS = 7;
+
+    size_t rows = 0;
+    int64_t totalQuantity = 0;
+    int64_t expiredQuantity = 0;          // Expired by the snapshot but not swept yet
+    int64_t expiringByDay[DAYS + 1] = {}; // [d]: in (d, d + 1] days from the snapshot; [DAYS]: later
+    std::vector<std::pair<int64_t, UserId>> topRestaurants;   // Most quantity first
+    std::vector<std::pair<int64_t, std::string>> topItems;    // Most quantity first
+
+    // Over rows [begin, end): sums[k] += quantity expiring more than k days after the
+    // snapshot, for k in 0..DAYS, and sums[DAYS + 1] += all quantity. Quantities are
+    // never negative and at most maxQuantity. With SSE2 this is branch-free, four
+    // rows at a time, in 32-bit lanes flushed to sums before they could wrap.
+    static void sumExpiringFrom(const int32_t* quantity, const int32_t* expiresIn, size_t begin, size_t end, int32_t maxQuantity, int64_t* sums) {
+        size_t i = begin;
+#ifdef __SSE2__
+        size_t flushEvery = 4 * std::max<size_t>(1, UINT32_MAX / static_cast<uint32_t>(std::max<int32_t>(maxQuantity, 1)));
+        __m128i edges[DAYS + 1];
+        for (int k = 0; k <= DAYS; ++k) {
+            edges[k] = _mm_set1_epi32(static_cast<int32_t>(k * SECONDS_PER_DAY));
+        }
+        while (i + 4 <= end) {
+            size_t blockEnd = i + std::min(end - i, flushEvery) / 4 * 4;
+            __m128i lanes[DAYS + 2];
+            for (int k = 0; k < DAYS + 2; ++k) {
+                lanes[k] = _mm_setzero_si128();
+            }
+            for (; i < blockEnd; i += 4) {
+                __m128i q = _mm_loadu_si128(reinterpret_cast<const __m128i*>(quantity + i));
+                __m128i e = _mm_loadu_si128(reinterpret_cast<const __m128i*>(expiresIn + i));
+#pragma GCC unroll 8 // Keeps the lane sums in registers
+                for (int k = 0; k <= DAYS; ++k) {
+                    lanes[k] = _mm_add_epi32(lanes[k], _mm_and_si128(q, _mm_cmpgt_epi32(e, edges[k])));
+                }
+                lanes[DAYS + 1] = _mm_add_epi32(lanes[DAYS + 1], q);
+            }
+            for (int k = 0; k < DAYS + 2; ++k) {
+                uint32_t lane[4];
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(lane), lanes[k]);
+                sums[k] += static_cast<int64_t>(lane[0]) + lane[1] + lane[2] + lane[3];
+            }
+        }
+#else
+        (void)maxQuantity;
+#endif
+        for (; i < end; ++i) {
+            for (int k = 0; k <= DAYS; ++k) {
+                sums[k] += expiresIn[i] > k * SECONDS_PER_DAY ? quantity[i] : 0;
+            }
+            sums[DAYS + 1] += quantity[i];
+        }
+    }
+
+    static WasteReport aggregate(const ItemColumns& columns, ThreadPool& pool, size_t top) {
+        struct Partial {
+            int64_t sums[DAYS + 2] = {};
+            std::vector<int64_t> byOwner;
+            std::vector<int64_t> byName;
+        };
+
+        size_t rows = columns.size();
+        size_t parts = std::max<size_t>(1, std::min(pool.size(), rows / 65536));
+        std::vector<Partial> partials(parts);
+        std::vector<std::future<void>> done; // Only this report's ranges; the pool may be running another's
+        for (size_t part = 0; part < parts; ++part) {
+            auto range = std::make_shared<std::packaged_task<void()>>([&columns, &partials, part, parts, rows] {
+                Partial& partial = partials[part];
+                size_t begin = rows * part / parts, end = rows * (part + 1) / parts;
+                const int32_t* quantity = columns.quantities();
+                sumExpiringFrom(quantity, columns.expiryOffsets(), begin, end, columns.getMaxQuantity(), partial.sums);
+
+                partial.byOwner.assign(columns.getOwnerBound(), 0);
+                partial.byName.assign(columns.nameCount(), 0);
+                const UserId* owner = columns.owners();
+                const uint32_t* nameId = columns.nameIdsByRow();
+                for (size_t i = begin; i < end; ++i) {
+                    partial.byOwner[owner[i]] += quantity[i];
+                    partial.byName[nameId[i]] += quantity[i];
+                }
+            });
+            done.push_back(range->get_future());
+            pool.submit([range] {
+                (*range)();
+            });
+        }
+        for (std::future<void>& range : done) {
+            range.wait(); // Every range is done with partials before any failure unwinds them
+        }
+        for (std::future<void>& range : done) {
+            range.get(); // Rethrows a range's failure rather than reporting its sums as 0
+        }
+
+        WasteReport report;
+        report.rows = rows;
+        std::vector<int64_t> byOwner(columns.getOwnerBound(), 0), byName(columns.nameCount(), 0);
+        int64_t sums[DAYS + 2] = {};
+        for (const Partial& partial : partials) {
+            for (int k = 0; k < DAYS + 2; ++k) {
+                sums[k] += partial.sums[k];
+            }
+            for (size_t owner = 0; owner < partial.byOwner.size(); ++owner) {
+                byOwner[owner] += partial.byOwner[owner];
+            }
+            for (size_t id = 0; id < partial.byName.size(); ++id) {
+                byName[id] += partial.byName[id];
+            }
+        }
+        report.totalQuantity = sums[DAYS + 1];
+        report.expiredQuantity = sums[DAYS + 1] - sums[0];
+        for (int d = 0; d < DAYS; ++d) {
+            report.expiringByDay[d] = sums[d] - sums[d + 1];
+        }
+        report.expiringByDay[DAYS] = sums[DAYS];
+
+        for (UserId owner = 0; owner < byOwner.size(); ++owner) {
+            if (byOwner[owner] > 0) {
+                report.topRestaurants.emplace_back(byOwner[owner], owner);
+            }
+        }
+        auto most = [](const auto& a, const auto& b) { return a.first > b.first || (a.first == b.first && a.second < b.second); };
+        size_t shown = std::min(top, report.topRestaurants.size());
+        std::partial_sort(report.topRestaurants.begin(), report.topRestaurants.begin() + shown, report.topRestaurants.end(), most);
+        report.topRestaurants.resize(shown);
+
+        std::vector<std::pair<int64_t, uint32_t>> items;
+        for (uint32_t id = 0; id < byName.size(); ++id) {
+            if (byName[id] > 0) {
+                items.emplace_back(byName[id], id);
+            }
+        }
+        shown = std::min(top, items.size());
+        std::partial_sort(items.begin(), items.begin() + shown, items.end(), most);
+        for (size_t i = 0; i < shown; ++i) {
+            report.topItems.emplace_back(items[i].first, columns.name(items[i].second));
+        }
+        return report;
+    }
+};
+
+// Choices of the console menu, in the order it lists them. Like the line protocol,
+// the role check of each choice is compiled from its row (see FoodApp::admitChoice).
+enum ConsoleChoice {
+    ADD_CHOICE,
+    VIEW_CHOICE,
+    EXPIRING_CHOICE,
+    NOTIFICATIONS_CHOICE,
+    LOGOUT_CHOICE,
+    SEARCH_CHOICE,
+    CLAIM_CHOICE,
+    ALERTS_CHOICE,
+    LOCATE_CHOICE,
+    NEAR_CHOICE,
+    CONSOLE_CHOICE_COUNT
+};
+
+struct ConsoleChoiceSpec {
+    ConsoleChoice choice;
+    const char* label;
+    RoleMask roles;     // Who may pick it; the menu is only shown after login
+    const char* denied; // Shown to anyone else
+};
+
+constexpr ConsoleChoiceSpec CONSOLE_CHOICES[CONSOLE_CHOICE_COUNT] = {
+    {ADD_CHOICE, "Add Food Item (Restaurant)", RESTAURANT_ROLE, "Only restaurants can add food items."},
+    {VIEW_CHOICE, "View Food Items (People)", PEOPLE_ROLE, "Only people can view food items."},
+    {EXPIRING_CHOICE, "View Expiring Items (People)", PEOPLE_ROLE, "Only people can view expiring items."},
+    {NOTIFICATIONS_CHOICE, "Notifications", ANY_ROLE, ""},
+    {LOGOUT_CHOICE, "Logout", ANY_ROLE, ""},
+    {SEARCH_CHOICE, "Search Food Items (People)", PEOPLE_ROLE, "Only people can search food items."},
+    {CLAIM_CHOICE, "Claim Food Item (People)", PEOPLE_ROLE, "Only people can claim food items."},
+    {ALERTS_CHOICE, "Food Alerts (People)", PEOPLE_ROLE, "Only people can subscribe to food alerts."},
+    {LOCATE_CHOICE, "Set Location", ANY_ROLE, ""},
+    {NEAR_CHOICE, "Food Near Me (People)", PEOPLE_ROLE, "Only people can look for food nearby."}
+};
+
+constexpr bool consoleChoiceAllowed(ConsoleChoice choice, Role role) {
+    return (CONSOLE_CHOICES[choice].roles & role) != 0;
+}
+
+static_assert(consoleChoiceAllowed(ADD_CHOICE, RESTAURANT_ROLE) && !consoleChoiceAllowed(ADD_CHOICE, PEOPLE_ROLE), "only restaurants list food");
+static_assert(consoleChoiceAllowed(CLAIM_CHOICE, PEOPLE_ROLE) && !consoleChoiceAllowed(CLAIM_CHOICE, RESTAURANT_ROLE), "only people claim food");
+static_assert(consoleChoiceAllowed(NOTIFICATIONS_CHOICE, RESTAURANT_ROLE) && consoleChoiceAllowed(NOTIFICATIONS_CHOICE, PEOPLE_ROLE),
+              "restaurants are sent expiry notices, so everyone reads notifications");
+static_assert(consoleChoiceAllowed(LOGOUT_CHOICE, PEOPLE_ROLE) && consoleChoiceAllowed(LOGOUT_CHOICE, RESTAURANT_ROLE), "anyone can log out");
+
+class FoodApp {
+private:
+    ShardedFoodStore foodItems; // The one store of food items and their indexes
+
+    bool loggedIn;
+    User currentUser;
+    NotificationCenter notifications;
+    SubscriptionIndex subscriptions;
+    SpatialGrid places;
+    UserDirectory users;
+
+    // Durable state: the snapshot holds everything up to logGeneration, and
+    // wal-<logGeneration>.log holds every change since. Empty directory = in-memory only.
+    static const size_t SNAPSHOT_INTERVAL = 100000;
+    std::string dataDirectory;
+    WriteAheadLog wal;
+    uint64_t logGeneration;
+    std::atomic<size_t> recordsSinceSnapshot;
+    std::atomic<bool> snapshotDue;
+    bool plaintextOnDisk; // Recovery read passwords written before they were hashed
+
+    // Nesting depth of batchCommits on this thread; while above zero, actions leave
+    // their log records for the batch's single commit
+    inline static thread_local int deferredCommits = 0;
+
+    // Sessions of network clients; not persisted, so clients log in again after a restart
+    static const time_t SESSION_IDLE_SECONDS = 30 * 60;
+    SessionTable sessions;
+
+    // Expired items are removed by a background sweeper, SWEEP_BATCH at a time so
+    // request handling never waits long for a shard. Replay drops everything that
+    // expired before the last logged sweep.
+    static const size_t SWEEP_BATCH = 4;
+    static constexpr int SWEEP_INTERVAL_SECONDS = 60;
+    std::thread sweeper;
+    std::mutex sweeperLock;
+    std::condition_variable sweeperWake;
+    bool sweeperStopping;
+    std::atomic<size_t> sweptCount;
+    time_t sweptUntil;
+
+    static const size_t CONSOLE_PAGE_ROWS = 100;
+    static const size_t SEARCH_RESULTS = 20;
+    static const size_t NEARBY_RESTAURANTS = 10;
+    static const size_t REPORT_ROWS = 10; // Restaurants and items listed by the waste report
+    OutputFormat outputFormat;
+
+    // Aggregates waste reports; started by the first report and shared by all after it
+    mutable std::once_flag reportPoolStarted;
+    mutable std::unique_ptr<ThreadPool> reportPool;
+
+    // Every change holds this shared while it updates state and appends its log
+    // records; a snapshot holds it exclusively so it sees state and log agree.
+    std::shared_mutex stateLock;
+
+public:
+    FoodApp() : loggedIn(false), currentUser("", "", ""), logGeneration(0), recordsSinceSnapshot(0), snapshotDue(false), plaintextOnDisk(false), sessions(SESSION_IDLE_SECONDS),
+          sweeperStopping(false), sweptCount(0), sweptUntil(0), outputFormat(PLAIN_OUTPUT) {
+        notifications.setDeliveryListener([this](const Notification& notification) {
+            logNotification(notification);
+        });
+    }
+
+    ~FoodApp() {
+        stopSweeper();
+    }
+
+    FoodApp(const FoodApp&) = delete;
+    FoodApp& operator=(const FoodApp&) = delete;
+
+    void run() {
+        while (true) {
+            try {
+                if (!loggedIn) {
+                    handleLoginSignup();
+                } else {
+                    handleUserActions();
+                }
+            } catch (const std::exception& e) {
+                std::cerr << "\033[1;31mError: " << e.what() << "\033[0m" << std::endl;
+            } catch (...) {
+                std::cerr << "\033[1;31mAn unknown error occurred.\033[0m" << std::endl;
+            }
+        }
+    }
+
+    // Restores state from directory (snapshot, then the log written after it) and
+    // logs every later change there. Throws if the snapshot is unreadable.
+    void openDataDirectory(const std::string& directory) {
+        if (std::filesystem::create_directories(directory)) {
+            // It holds password hashes, so only the owner may read it
+            std::filesystem::permissions(directory, std::filesystem::perms::owner_all);
+        }
+        dataDirectory = directory;
+
+        std::string snapshotPath = dataDirectory + "/snapshot.bin";
+        if (std::filesystem::exists(snapshotPath)) {
+            loadSnapshot(snapshotPath);
+        }
+
+        std::string logPath = logPathFor(logGeneration);
+        if (std::filesystem::exists(logPath)) {
+            std::vector<FoodItem> replayed;
+            size_t intact = WriteAheadLog::replay(logPath, [this, &replayed](WriteAheadLog::RecordType type, BinaryReader& record) {
+                applyLogRecord(type, record, replayed);
+            });
+            replayed.erase(std::remove_if(replayed.begin(), replayed.end(), [this](const FoodItem& item) {
+                return item.getQuantity() == 0 || item.getExpiresAt() < sweptUntil; // Claimed in full or swept before the crash
+            }), replayed.end());
+            foodItems.insertBatch(std::move(replayed));
+            foodItems.removeExpired(sweptUntil, std::numeric_limits<size_t>::max(), [](const FoodItem&) {});
+            std::filesystem::resize_file(logPath, intact);
+        }
+        if (logGeneration > 0) {
+            // Left behind if a crash hit between installing the snapshot and deleting its log
+            std::filesystem::remove(logPathFor(logGeneration - 1));
+        }
+        wal.open(logPath);
+        if (plaintextOnDisk) {
+            writeSnapshot(); // Rewrites the passwords as hashes and drops the log that held them
+            plaintextOnDisk = false;
+        }
+    }
+
+    // Writes a compact snapshot of all state and starts a fresh log generation.
+    // The snapshot is written to a temporary file and renamed into place, so a
+    // crash leaves either the old snapshot plus its log or the new one.
+    void writeSnapshot() {
+        if (dataDirectory.empty()) {
+            return;
+        }
+        std::unique_lock<std::shared_mutex> exclusive(stateLock);
+
+        BinaryWriter out;
+        out.data().append(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        out.put(static_cast<uint64_t>(logGeneration + 1));
+
+        out.put(static_cast<uint32_t>(users.size()));
+        for (UserId id = 0; id < users.size(); ++id) {
+            const User& user = users.get(id);
+            out.putString(user.getUsername());
+            out.putString(user.getPasswordHash());
+            out.putString(user.getUserType());
+        }
+
+        out.put(static_cast<uint32_t>(places.size()));
+        places.forEach([&out](UserId userId, const Location& location) {
+            out.put(userId);
+            out.put(location.latitude);
+            out.put(location.longitude);
+        });
+
+        out.put(static_cast<uint32_t>(subscriptions.size()));
+        subscriptions.forEach([&out](UserId userId, const std::string& keyword) {
+            out.put(userId);
+            out.putString(keyword);
+        });
+
+        out.put(static_cast<uint64_t>(foodItems.size()));
+        foodItems.forEachByName([&out](const FoodItem& item) {
+            out.put(item.getOwnerId());
+            out.put(static_cast<int32_t>(item.getQuantity()));
+            out.put(static_cast<int64_t>(item.getExpiresAt()));
+            out.putString(item.getName());
+        });
+
+        uint32_t notificationCount = 0;
+        notifications.forEachPending([&notificationCount](const Notification&) {
+            ++notificationCount;
+        });
+        out.put(notificationCount);
+        notifications.forEachPending([&out](const Notification& notification) {
+            out.put(notification.getRecipientId());
+            out.putString(notification.getMessage());
+        });
+
+        std::string& bytes = out.data();
+        out.put(checksum(bytes.data() + sizeof(SNAPSHOT_MAGIC), bytes.size() - sizeof(SNAPSHOT_MAGIC)));
+
+        std::string snapshotPath = dataDirectory + "/snapshot.bin";
+        std::string tempPath = snapshotPath + ".tmp";
+        FILE* file = fopen(tempPath.c_str(), "wb");
+        if (file == nullptr) {
+            throw std::runtime_error("cannot write snapshot " + tempPath);
+        }
+        bool written = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size() && fflush(file) == 0;
+#ifdef _WIN32
+        written = written && _commit(_fileno(file)) == 0;
+#else
+        written = written && fsync(fileno(file)) == 0;
+#endif
+        fclose(file);
+        if (!written) {
+            throw std::runtime_error("cannot write snapshot " + tempPath);
+        }
+
+        // The old log is only removed once the rename is synced, and the new log's entry
+        // is synced before anything is committed to it, so a power cut leaves the old
+        // snapshot with its log or the new one with its log
+        wal.close();
+        std::filesystem::rename(tempPath, snapshotPath);
+        bool synced = syncDirectory(dataDirectory);
+        if (synced) {
+            std::filesystem::remove(logPathFor(logGeneration));
+        }
+        ++logGeneration;
+        recordsSinceSnapshot = 0;
+        wal.open(logPathFor(logGeneration));
+        if (!syncDirectory(dataDirectory) || !synced) {
+            throw std::runtime_error("cannot sync " + dataDirectory);
+        }
+    }
+
+    // Removes every item that expired before now, SWEEP_BATCH items per lock hold,
+    // then tells each owner what went and logs the sweep. Returns the items removed.
+    size_t sweepExpired(time_t now) {
+        static const size_t NAMES_LISTED = 5;
+        std::unordered_map<UserId, std::vector<std::string>> expiredOf;
+        size_t removed = 0;
+        size_t batch;
+        do {
+            std::shared_lock<std::shared_mutex> acting(stateLock);
+            batch = foodItems.removeExpired(now, SWEEP_BATCH, [&expiredOf](const FoodItem& item) {
+                expiredOf[item.getOwnerId()].push_back(item.getName());
+            });
+            removed += batch;
+        } while (batch == SWEEP_BATCH);
+        if (removed == 0) {
+            return 0;
+        }
+
+        {
+            std::shared_lock<std::shared_mutex> acting(stateLock);
+            for (const auto& owner : expiredOf) {
+                const std::vector<std::string>& names = owner.second;
+                std::string message = "\033[1;31mExpired and removed: ";
+                for (size_t i = 0; i < names.size() && i < NAMES_LISTED; ++i) {
+                    message += (i == 0 ? "" : ", ") + names[i];
+                }
+                if (names.size() > NAMES_LISTED) {
+                    message += " and " + std::to_string(names.size() - NAMES_LISTED) + " more";
+                }
+                notifications.send(Notification(message + "\033[0m", owner.first));
+            }
+
+            BinaryWriter record;
+            record.put(static_cast<int64_t>(now));
+            logRecord(WriteAheadLog::SWEEP, record);
+        }
+        commitLog();
+        sweptCount += removed;
+        return removed;
+    }
+
+    // Sweeps expired items every SWEEP_INTERVAL_SECONDS on a background thread
+    void startSweeper() {
+        sweeperStopping = false;
+        sweeper = std::thread([this] {
+            std::unique_lock<std::mutex> guard(sweeperLock);
+            while (!sweeperWake.wait_for(guard, std::chrono::seconds(SWEEP_INTERVAL_SECONDS), [this] { return sweeperStopping; })) {
+                guard.unlock();
+                try {
+                    sweepExpired(time(nullptr));
+                } catch (const std::exception& e) {
+                    std::cerr << "\033[1;31mExpiry sweep failed: " << e.what() << "\033[0m" << std::endl;
+                }
+                guard.lock();
+            }
+        });
+    }
+
+    void stopSweeper() {
+        if (!sweeper.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> guard(sweeperLock);
+            sweeperStopping = true;
+        }
+        sweeperWake.notify_all();
+        sweeper.join();
+    }
+
+    // How the console writes item listings
+    void setOutputFormat(OutputFormat format) {
+        outputFormat = format;
+    }
+
+    // Runs run() with the log commits of the actions inside it deferred to one commit at
+    // the end, so a batch of changes costs a single sync. Returns once all of them are durable.
+    template <typename Run>
+    void batchCommits(Run run) {
+        ++deferredCommits;
+        try {
+            run();
+        } catch (...) {
+            --deferredCommits;
+            commitLog();
+            throw;
+        }
+        --deferredCommits;
+        commitLog();
+    }
+
+    // Per-command calls and sampled latency percentiles, then the sizes of the main structures
+    void dumpMetrics(std::ostream& out) const {
+        std::vector<Metrics::Summary> summaries = Metrics::snapshot();
+        out << "command            calls     p50 ns     p90 ns     p99 ns   p99.9 ns\n";
+        for (size_t command = 0; command < COMMAND_COUNT; ++command) {
+            const Metrics::Summary& summary = summaries[command];
+            out << std::left << std::setw(14) << Metrics::name(static_cast<MetricCommand>(command)) << std::right
+                << std::setw(10) << summary.calls << std::setw(11) << summary.percentile(0.5) << std::setw(11) << summary.percentile(0.9)
+                << std::setw(11) << summary.percentile(0.99) << std::setw(11) << summary.percentile(0.999) << "\n";
+        }
+        out << "items " << foodItems.size() << " (" << sweptCount.load() << " expired ones swept), users " << users.size() << ", pending notifications " << notifications.pendingTotal()
+            << ", sessions " << sessions.size() << std::endl;
+    }
+
+    ThreadPool& reportThreads() const {
+        std::call_once(reportPoolStarted, [this] {
+            reportPool.reset(new ThreadPool(ThreadPool::hardwareThreads()));
+        });
+        return *reportPool;
+    }
+
+    // Fleet-wide waste report: copies the items into columns under brief per-shard read
+    // locks, then aggregates the copy on the report pool without touching the store
+    void writeWasteReport(std::ostream& out, size_t top = REPORT_ROWS) const {
+        CommandTimer timer(REPORT_COMMAND);
+        auto start = std::chrono::steady_clock::now();
+        ItemColumns columns(time(nullptr));
+        foodItems.copyColumns(columns);
+        auto copied = std::chrono::steady_clock::now();
+        WasteReport report = WasteReport::aggregate(columns, reportThreads(), top);
+        auto aggregated = std::chrono::steady_clock::now();
+
+        auto millis = [](std::chrono::steady_clock::duration d) {
+            return std::chrono::duration_cast<std::chrono::microseconds>(d).count() / 1000.0;
+        };
+        out << "items " << report.rows << ", quantity " << report.totalQuantity << " (copied in " << millis(copied - start) << " ms, aggregated in "
+            << millis(aggregated - copied) << " ms)\n";
+        out << "expired, not swept yet " << report.expiredQuantity << "\n";
+        for (int d = 0; d < WasteReport::DAYS; ++d) {
+            out << "expiring within day " << d + 1 << " " << report.expiringByDay[d] << "\n";
+        }
+        out << "expiring later " << report.expiringByDay[WasteReport::DAYS] << "\n";
+        for (const auto& restaurant : report.topRestaurants) {
+            out << "restaurant " << users.get(restaurant.second).getUsername() << " " << restaurant.first << "\n";
+        }
+        for (const auto& item : report.topItems) {
+            out << "item " << item.second << " " << item.first << "\n";
+        }
+        out.flush();
+    }
+
+    // Snapshots on the way out so the next start does not replay the log
+    void shutdown() {
+        stopSweeper();
+        if (!dataDirectory.empty()) {
+            writeSnapshot();
+            wal.close();
+        }
+    }
+
+    // Non-interactive signup: validates the user type and registers the account
+    UserId registerUser(const User& user) {
+        CommandTimer timer(SIGNUP_COMMAND);
+        if (user.getRole() == NO_ROLE) {
+            throw InvalidArgumentException("\033[1;31mInvalid user type. Please choose 'people' or 'restaurant'.\033[0m");
+        }
+
+        UserId id;
+        {
+            std::shared_lock<std::shared_mutex> acting(stateLock);
+            id = users.add(user);
+            if (id == NO_USER) {
+                throw InvalidArgumentException("\033[1;31mUsername is already in use. Please choose a different username.\033[0m");
+            }
+
+            BinaryWriter record;
+            record.putString(user.getUsername());
+            record.putString(user.getPasswordHash());
+            record.putString(user.getUserType());
+            logRecord(WriteAheadLog::SIGNUP, record);
+        }
+        commitLog();
+        return id;
+    }
+
+    // Returns the id of the user with these credentials, or NO_USER
+    UserId authenticate(const std::string& username, const std::string& password) const {
+        CommandTimer timer(LOGIN_COMMAND);
+        const User* user = users.find(username);
+        if (user == nullptr || !user->checkPassword(password)) {
+            return NO_USER;
+        }
+        return user->getId();
+    }
+
+    // Checks the credentials once and returns a session token for them, or NO_SESSION
+    SessionToken openSession(const std::string& username, const std::string& password) {
+        UserId id = authenticate(username, password);
+        return id == NO_USER ? NO_SESSION : sessions.issue(id, time(nullptr));
+    }
+
+    // Returns the user of a live session, or NO_USER if it was closed or sat idle too long
+    UserId resolveSession(SessionToken token) {
+        return sessions.resolve(token, time(nullptr));
+    }
+
+    void closeSession(SessionToken token) {
+        sessions.revoke(token);
+    }
+
+    // Returns the id of the user with this username, or NO_USER
+    UserId findUser(const std::string& username) const {
+        const User* user = users.find(username);
+        return user == nullptr ? NO_USER : user->getId();
+    }
+
+    const User& getUser(UserId id) const {
+        return users.get(id);
+    }
+
+    // Lists an item for a restaurant after validating it like the console prompt does
+    ItemHandle listFoodItem(UserId restaurantId, const std::string& name, int quantity, int daysToExpiration) {
+        CommandTimer timer(ADD_COMMAND);
+        if (name.empty()) {
+            throw InvalidArgumentException("\033[1;31mFood item name cannot be empty.\033[0m");
+        }
+        if (quantity <= 0) {
+            throw InvalidArgumentException("\033[1;31mQuantity must be greater than 0.\033[0m");
+        }
+        if (daysToExpiration <= 0) {
+            throw InvalidArgumentException("\033[1;31mDays to expiration must be greater than 0.\033[0m");
+        }
+        if (restaurantId >= users.size() || users.get(restaurantId).getRole() != RESTAURANT_ROLE) {
+            throw InvalidArgumentException("\033[1;31mError: Only restaurants can add food items.\033[0m");
+        }
+        const User& restaurant = users.get(restaurantId);
+
+        FoodItem item(name, quantity, time(nullptr) + static_cast<time_t>(daysToExpiration) * SECONDS_PER_DAY, restaurantId);
+        ItemHandle handle;
+        {
+            // Logged before it is stored, so no claim of it can be logged ahead of it
+            std::shared_lock<std::shared_mutex> acting(stateLock);
+            logItem(item);
+            handle = Restaurant::addFoodItem(item, foodItems, notifications);
+
+            // Every matching subscriber gets the same message, built and stored once
+            std::vector<UserId> matched;
+            subscriptions.match(name, matched);
+            if (!matched.empty()) {
+                notifications.send(matched, "\033[1;32mNew listing: " + describeListing(item, restaurant.getUsername()) + "\033[0m");
+            }
+        }
+        commitLog();
+        return handle;
+    }
+
+    // Takes up to quantity units of restaurantName's soonest-expiring unexpired item
+    // called itemName for a person; returns how many were taken (0 if none are left)
+    int claimFoodItem(UserId personId, const std::string& restaurantName, const std::string& itemName, int quantity) {
+        CommandTimer timer(CLAIM_COMMAND);
+        if (quantity <= 0) {
+            throw InvalidArgumentException("\033[1;31mQuantity must be greater than 0.\033[0m");
+        }
+        if (personId >= users.size() || users.get(personId).getRole() != PEOPLE_ROLE) {
+            throw InvalidArgumentException("\033[1;31mOnly people can claim food items.\033[0m");
+        }
+        UserId restaurantId = findUser(restaurantName);
+        if (restaurantId == NO_USER || users.get(restaurantId).getRole() != RESTAURANT_ROLE) {
+            throw InvalidArgumentException("\033[1;31mNo restaurant called " + restaurantName + ".\033[0m");
+        }
+
+        Claim claim;
+        {
+            std::shared_lock<std::shared_mutex> acting(stateLock);
+            claim = foodItems.claim(restaurantId, itemName, time(nullptr), quantity);
+            if (claim.taken > 0) {
+                BinaryWriter record;
+                record.put(restaurantId);
+                record.put(static_cast<int32_t>(claim.taken));
+                record.put(static_cast<int64_t>(claim.expiresAt));
+                record.putString(itemName);
+                logRecord(WriteAheadLog::CLAIM, record);
+            }
+        }
+        if (claim.taken > 0) {
+            commitLog();
+        }
+        return claim.taken;
+    }
+
+    // Alerts personId whenever a listing's name contains keyword as a word; false if they already had it
+    bool subscribe(UserId personId, const std::string& keyword) {
+        return changeSubscription(personId, keyword, true);
+    }
+
+    // Stops the alerts for keyword; false if personId was not subscribed to it
+    bool unsubscribe(UserId personId, const std::string& keyword) {
+        return changeSubscription(personId, keyword, false);
+    }
+
+    std::vector<std::string> getSubscriptions(UserId personId) const {
+        return subscriptions.keywords(personId);
+    }
+
+    // Sets where a user is; restaurants become findable by forEachNearby
+    void setLocation(UserId userId, const Location& location) {
+        if (!SpatialGrid::valid(location)) {
+            throw InvalidArgumentException("\033[1;31mLatitude must be within -90..90 and longitude within -180..180.\033[0m");
+        }
+        if (userId >= users.size()) {
+            throw InvalidArgumentException("\033[1;31mUnknown user.\033[0m");
+        }
+        {
+            std::shared_lock<std::shared_mutex> acting(stateLock);
+            places.place(userId, location, users.get(userId).getRole() == RESTAURANT_ROLE);
+            BinaryWriter record;
+            record.put(userId);
+            record.put(location.latitude);
+            record.put(location.longitude);
+            logRecord(WriteAheadLog::LOCATE, record);
+        }
+        commitLog();
+    }
+
+    bool getLocation(UserId userId, Location& location) const {
+        return places.find(userId, location);
+    }
+
+    // Food near me expiring soonest: visit(restaurant, km, item) gets the soonest-expiring
+    // unexpired item of each of the k nearest restaurants that have one, nearest first
+    template <typename Visit>
+    size_t forEachNearby(UserId personId, size_t k, Visit visit) const {
+        CommandTimer timer(NEARBY_COMMAND);
+        Location here{};
+        if (!places.find(personId, here)) {
+            throw InvalidArgumentException("\033[1;31mSet your location first.\033[0m");
+        }
+
+        time_t currentTime = time(nullptr);
+        size_t found = 0;
+        if (k > 0) {
+            places.forEachNearest(here, [this, &visit, &found, k, currentTime](UserId restaurantId, double km) {
+                found += foodItems.withSoonestExpiring(restaurantId, currentTime, [this, &visit, restaurantId, km](const FoodItem& item) {
+                    visit(users.get(restaurantId), km, item);
+                });
+                return found < k;
+            });
+        }
+        return found;
+    }
+
+    // Streams up to limit of an owner's items in name order, resuming after cursor.
+    // visit runs under store read locks, so it should format and return quickly.
+    template <typename Visit>
+    size_t forEachFoodItem(UserId ownerId, PageCursor& cursor, size_t limit, Visit visit) const {
+        CommandTimer timer(VIEW_COMMAND);
+        return foodItems.forEachFoodItem(ownerId, cursor, limit, visit);
+    }
+
+    // Streams up to limit of every restaurant's items expiring in [from, until], soonest first
+    template <typename Visit>
+    size_t forEachExpiring(time_t from, time_t until, PageCursor& cursor, size_t limit, Visit visit) const {
+        CommandTimer timer(EXPIRING_COMMAND);
+        return foodItems.forEachExpiring(from, until, cursor, limit, visit);
+    }
+
+    // Streams the k soonest-expiring unexpired items whose name contains query, or starts with it if it ends in '*'
+    template <typename Visit>
+    size_t searchFoodItems(const std::string& query, time_t from, size_t k, Visit visit) const {
+        CommandTimer timer(SEARCH_COMMAND);
+        return foodItems.search(query, from, k, visit);
+    }
+
+    // Hands each pending notification of recipientId to visit and logs that they were read
+    template <typename Visit>
+    size_t drainNotifications(UserId recipientId, Visit visit) {
+        CommandTimer timer(NOTIFICATIONS_COMMAND);
+        size_t drained;
+        {
+            std::shared_lock<std::shared_mutex> acting(stateLock);
+            drained = notifications.drain(recipientId, visit);
+            if (drained > 0) {
+                BinaryWriter record;
+                record.put(recipientId);
+                logRecord(WriteAheadLog::DRAIN_NOTIFICATIONS, record);
+            }
+        }
+        if (drained > 0) {
+            commitLog();
+        }
+        return drained;
+    }
+
+    // Non-interactive bulk listing from a CSV stream of "restaurant,name,quantity,days"
+    // lines (blank lines and lines starting with '#' are skipped). Records are
+    // validated with the same rules as the interactive prompt, invalid ones are
+    // reported and dropped, and the valid ones are inserted INGEST_BATCH at a time,
+    // each batch sorted, logged and committed on its own. The state lock is only
+    // held while a batch goes in, so snapshots can run between batches, and memory
+    // stays bounded by one batch however long the stream is.
+    size_t ingest(std::istream& in, std::ostream& report) {
+        auto start = std::chrono::steady_clock::now();
+        time_t currentTime = time(nullptr);
+
+        std::vector<FoodItem> batch;
+        batch.reserve(INGEST_BATCH);
+        size_t accepted = 0;
+        size_t rejected = 0;
+        size_t lineNumber = 0;
+        std::string line;
+        std::string cachedRestaurant;
+        UserId cachedRestaurantId = NO_USER;
+
+        while (std::getline(in, line)) {
+            ++lineNumber;
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+
+            std::string fields[4];
+            size_t fieldCount = 0;
+            size_t begin = 0;
+            bool extraFields = false;
+            while (true) {
+                size_t comma = line.find(',', begin);
+                if (fieldCount == 4) {
+                    extraFields = true;
+                    break;
+                }
+                fields[fieldCount++] = line.substr(begin, comma - begin);
+                if (comma == std::string::npos) {
+                    break;
+                }
+                begin = comma + 1;
+            }
+
+            const char* error = nullptr;
+            int quantity = 0, daysToExpiration = 0;
+            if (fieldCount != 4 || extraFields) {
+                error = "expected restaurant,name,quantity,days";
+            } else if (fields[1].empty()) {
+                error = "food item name cannot be empty";
+            } else if (!parsePositive(fields[2], quantity)) {
+                error = "quantity must be a whole number greater than 0";
+            } else if (!parsePositive(fields[3], daysToExpiration)) {
+                error = "days to expiration must be a whole number greater than 0";
+            } else if (fields[0] != cachedRestaurant) {
+                // Exports are usually grouped by restaurant, so remember the last lookup
+                const User* restaurant = users.find(fields[0]);
+                if (restaurant == nullptr || restaurant->getRole() != RESTAURANT_ROLE) {
+                    error = "unknown restaurant";
+                } else {
+                    cachedRestaurant = fields[0];
+                    cachedRestaurantId = restaurant->getId();
+                }
+            }
+
+            if (error != nullptr) {
+                ++rejected;
+                report << "line " << lineNumber << ": " << error << std::endl;
+                continue;
+            }
+
+            time_t expiresAt = currentTime + static_cast<time_t>(daysToExpiration) * SECONDS_PER_DAY;
+            batch.emplace_back(fields[1], quantity, expiresAt, cachedRestaurantId);
+            if (batch.size() == INGEST_BATCH) {
+                accepted += ingestBatch(batch);
+            }
+        }
+        accepted += ingestBatch(batch);
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        report << "Ingested " << accepted << " records (" << rejected << " rejected) in " << seconds * 1000 << " ms, "
+               << static_cast<long long>((accepted + rejected) / std::max(seconds, 1e-9)) << " records/s" << std::endl;
+        return accepted;
+    }
+
+private:
+    static const size_t INGEST_BATCH = 65536; // Records validated, then inserted and committed together
+
+    // Logs, announces and inserts one batch of validated ingest records, then commits
+    // them; leaves batch empty for the next one. Returns how many went in.
+    size_t ingestBatch(std::vector<FoodItem>& batch) {
+        size_t count = batch.size();
+        if (count == 0) {
+            return 0;
+        }
+        {
+            std::shared_lock<std::shared_mutex> acting(stateLock);
+            for (const FoodItem& item : batch) {
+                logItem(item);
+            }
+            alertSubscribers(batch);
+            foodItems.insertBatch(std::move(batch));
+        }
+        commitLog();
+        batch.clear();
+        batch.reserve(INGEST_BATCH);
+        return count;
+    }
+
+    static constexpr char SNAPSHOT_MAGIC[8] = {'F', 'G', 'S', 'N', 'A', 'P', '0', '4'}; // 01 had no subscriptions, 02 no locations, 03 plaintext passwords
+
+    std::string logPathFor(uint64_t generation) const {
+        return dataDirectory + "/wal-" + std::to_string(generation) + ".log";
+    }
+
+    void logRecord(WriteAheadLog::RecordType type, BinaryWriter& record) {
+        if (wal.append(type, record)) {
+            ++recordsSinceSnapshot;
+        }
+    }
+
+    void logItem(const FoodItem& item) {
+        BinaryWriter record;
+        record.put(item.getOwnerId());
+        record.put(static_cast<int32_t>(item.getQuantity()));
+        record.put(static_cast<int64_t>(item.getExpiresAt()));
+        record.putString(item.getName());
+        logRecord(WriteAheadLog::ADD_ITEM, record);
+    }
+
+    void logNotification(const Notification& notification) {
+        BinaryWriter record;
+        record.put(notification.getRecipientId());
+        record.putString(notification.getMessage());
+        logRecord(WriteAheadLog::NOTIFY, record);
+    }
+
+    bool changeSubscription(UserId personId, const std::string& keyword, bool subscribing) {
+        CommandTimer timer(SUBSCRIBE_COMMAND);
+        if (personId >= users.size() || users.get(personId).getRole() != PEOPLE_ROLE) {
+            throw InvalidArgumentException("\033[1;31mOnly people can subscribe to food alerts.\033[0m");
+        }
+        std::string folded = SubscriptionIndex::normalize(keyword);
+        if (folded.empty()) {
+            throw InvalidArgumentException("\033[1;31mKeyword must be one word of up to 32 letters or digits.\033[0m");
+        }
+
+        bool changed;
+        {
+            std::shared_lock<std::shared_mutex> acting(stateLock);
+            changed = subscribing ? subscriptions.subscribe(personId, folded) : subscriptions.unsubscribe(personId, folded);
+            if (!changed && subscribing && subscriptions.keywords(personId).size() >= SubscriptionIndex::MAX_KEYWORDS_PER_USER) {
+                throw InvalidArgumentException("\033[1;31mYou can subscribe to at most 32 keywords.\033[0m");
+            }
+            if (changed) {
+                BinaryWriter record;
+                record.put(personId);
+                record.putString(folded);
+                logRecord(subscribing ? WriteAheadLog::SUBSCRIBE : WriteAheadLog::UNSUBSCRIBE, record);
+            }
+        }
+        if (changed) {
+            commitLog();
+        }
+        return changed;
+    }
+
+    // "5 bread at Bakery, 2 days left"
+    static std::string describeListing(const FoodItem& item, const std::string& restaurantName) {
+        return std::to_string(item.getQuantity()) + " " + item.getName() + " at " + restaurantName + ", " +
+               std::to_string(item.getDaysToExpiration()) + " days left";
+    }
+
+    // Sends each subscriber one digest of the batch's listings that match their
+    // keywords, rather than one notification per listing
+    void alertSubscribers(const std::vector<FoodItem>& batch) {
+        static const size_t DIGEST_LISTINGS = 3;
+        if (subscriptions.size() == 0) {
+            return;
+        }
+        std::unordered_map<UserId, std::vector<size_t>> matchesOf;
+        std::vector<UserId> matched;
+        for (size_t i = 0; i < batch.size(); ++i) {
+            subscriptions.match(batch[i].getName(), matched);
+            for (UserId subscriber : matched) {
+                matchesOf[subscriber].push_back(i);
+            }
+        }
+
+        for (const auto& subscriber : matchesOf) {
+            const std::vector<size_t>& listings = subscriber.second;
+            std::string message = listings.size() == 1 ? "\033[1;32mNew listing: " : "\033[1;32m" + std::to_string(listings.size()) + " new listings: ";
+            for (size_t i = 0; i < listings.size() && i < DIGEST_LISTINGS; ++i) {
+                const FoodItem& item = batch[listings[i]];
+                message += (i == 0 ? "" : "; ") + describeListing(item, users.get(item.getOwnerId()).getUsername());
+            }
+            if (listings.size() > DIGEST_LISTINGS) {
+                message += " and " + std::to_string(listings.size() - DIGEST_LISTINGS) + " more";
+            }
+            notifications.send(Notification(message + "\033[0m", subscriber.first));
+        }
+    }
+
+    // Makes the changes of the current action durable, snapshotting once the log has grown enough.
+    // Called without stateLock held; concurrent committers share one sync, and one of them snapshots.
+    // Inside batchCommits it does nothing until the batch ends.
+    void commitLog() {
+        if (deferredCommits > 0) {
+            return;
+        }
+        wal.commit();
+        if (recordsSinceSnapshot >= SNAPSHOT_INTERVAL && !snapshotDue.exchange(true)) {
+            try {
+                if (recordsSinceSnapshot >= SNAPSHOT_INTERVAL) {
+                    writeSnapshot();
+                }
+            } catch (...) {
+                snapshotDue = false;
+                throw;
+            }
+            snapshotDue = false;
+        }
+    }
+
+    // Replays one log record; item adds are collected so they can be inserted as one batch.
+    // The log is not open yet during recovery, so re-delivered notifications are not journaled again.
+    void applyLogRecord(WriteAheadLog::RecordType type, BinaryReader& record, std::vector<FoodItem>& replayedItems) {
+        switch (type) {
+            case WriteAheadLog::SIGNUP: {
+                std::string username = record.getString();
+                std::string passwordHash = record.getString();
+                std::string userType = record.getString();
+                users.add(User::withPasswordHash(username, passwordHash, userType));
+                break;
+            }
+            case WriteAheadLog::PLAINTEXT_SIGNUP: {
+                std::string username = record.getString();
+                std::string password = record.getString();
+                std::string userType = record.getString();
+                users.add(User(username, password, userType));
+                plaintextOnDisk = true;
+                break;
+            }
+            case WriteAheadLog::ADD_ITEM: {
+                UserId ownerId = record.get<UserId>();
+                int32_t quantity = record.get<int32_t>();
+                int64_t expiresAt = record.get<int64_t>();
+                replayedItems.emplace_back(record.getString(), quantity, static_cast<time_t>(expiresAt), ownerId);
+                break;
+            }
+            case WriteAheadLog::NOTIFY: {
+                UserId recipientId = record.get<UserId>();
+                notifications.send(Notification(record.getString(), recipientId));
+                break;
+            }
+            case WriteAheadLog::DRAIN_NOTIFICATIONS:
+                notifications.drain(record.get<UserId>(), [](const Notification&) {});
+                break;
+            case WriteAheadLog::LOCATE: {
+                UserId userId = record.get<UserId>();
+                Location location;
+                location.latitude = record.get<double>();
+                location.longitude = record.get<double>();
+                places.place(userId, location, userId < users.size() && users.get(userId).getRole() == RESTAURANT_ROLE);
+                break;
+            }
+            case WriteAheadLog::SWEEP:
+                sweptUntil = std::max(sweptUntil, static_cast<time_t>(record.get<int64_t>()));
+                break;
+            case WriteAheadLog::SUBSCRIBE: {
+                UserId userId = record.get<UserId>();
+                subscriptions.subscribe(userId, record.getString());
+                break;
+            }
+            case WriteAheadLog::UNSUBSCRIBE: {
+                UserId userId = record.get<UserId>();
+                subscriptions.unsubscribe(userId, record.getString());
+                break;
+            }
+            case WriteAheadLog::CLAIM: {
+                UserId ownerId = record.get<UserId>();
+                int32_t taken = record.get<int32_t>();
+                time_t expiresAt = static_cast<time_t>(record.get<int64_t>());
+                std::string name = record.getString();
+                // The record names one item by owner, name and exact expiry (items alike in
+                // all three are interchangeable). It is either not inserted yet or in the
+                // store, and only it is claimed: units it lacks are not taken from another.
+                int found = 0;
+                auto replayedItem = std::find_if(replayedItems.begin(), replayedItems.end(), [&](const FoodItem& item) {
+                    return item.getOwnerId() == ownerId && item.getExpiresAt() == expiresAt && item.getQuantity() > 0 && item.getName() == name;
+                });
+                if (replayedItem != replayedItems.end()) {
+                    found = std::min(replayedItem->claim(taken), taken);
+                } else {
+                    found = foodItems.claim(ownerId, name, expiresAt, taken, expiresAt).taken;
+                }
+                if (found < taken) {
+                    std::cerr << "\033[1;31mWarning: replayed claim of " << taken << " " << name << " found only " << found << "\033[0m" << std::endl;
+                }
+                break;
+            }
+        }
+        ++recordsSinceSnapshot;
+    }
+
+    void loadSnapshot(const std::string& path) {
+        MappedFile snapshot(path);
+        const size_t header = sizeof(SNAPSHOT_MAGIC);
+        if (snapshot.size() < header + sizeof(uint32_t) || memcmp(snapshot.data(), SNAPSHOT_MAGIC, header - 1) != 0 ||
+            snapshot.data()[header - 1] < '1' || snapshot.data()[header - 1] > SNAPSHOT_MAGIC[header - 1]) {
+            throw std::runtime_error("snapshot " + path + " is not a FoodGuard snapshot");
+        }
+        bool hasSubscriptions = snapshot.data()[header - 1] >= '2';
+        bool hasLocations = snapshot.data()[header - 1] >= '3';
+        bool hasPasswordHashes = snapshot.data()[header - 1] >= '4';
+        plaintextOnDisk = !hasPasswordHashes;
+
+        size_t bodySize = snapshot.size() - header - sizeof(uint32_t);
+        uint32_t expected;
+        memcpy(&expected, snapshot.data() + header + bodySize, sizeof(expected));
+        if (checksum(snapshot.data() + header, bodySize) != expected) {
+            throw std::runtime_error("snapshot " + path + " is corrupt");
+        }
+
+        BinaryReader in(snapshot.data() + header, bodySize);
+        logGeneration = in.get<uint64_t>();
+
+        uint32_t userCount = in.get<uint32_t>();
+        for (uint32_t i = 0; i < userCount && in.ok(); ++i) {
+            std::string username = in.getString();
+            std::string password = in.getString(); // A hash unless the snapshot predates them
+            std::string userType = in.getString();
+            users.add(hasPasswordHashes ? User::withPasswordHash(username, password, userType) : User(username, password, userType));
+        }
+
+        uint32_t locationCount = hasLocations ? in.get<uint32_t>() : 0;
+        for (uint32_t i = 0; i < locationCount && in.ok(); ++i) {
+            UserId userId = in.get<UserId>();
+            Location location;
+            location.latitude = in.get<double>();
+            location.longitude = in.get<double>();
+            places.place(userId, location, userId < users.size() && users.get(userId).getRole() == RESTAURANT_ROLE);
+        }
+
+        uint32_t subscriptionCount = hasSubscriptions ? in.get<uint32_t>() : 0;
+        for (uint32_t i = 0; i < subscriptionCount && in.ok(); ++i) {
+            UserId userId = in.get<UserId>();
+            subscriptions.subscribe(userId, in.getString());
+        }
+
+        uint64_t itemCount = in.get<uint64_t>();
+        std::vector<FoodItem> items;
+        items.reserve(static_cast<size_t>(std::min<uint64_t>(itemCount, in.remaining())));
+        for (uint64_t i = 0; i < itemCount && in.ok(); ++i) {
+            UserId ownerId = in.get<UserId>();
+            int32_t quantity = in.get<int32_t>();
+            int64_t expiresAt = in.get<int64_t>();
+            items.emplace_back(in.getString(), quantity, static_cast<time_t>(expiresAt), ownerId);
+        }
+        foodItems.insertBatch(std::move(items));
+
+        uint32_t notificationCount = in.get<uint32_t>();
+        for (uint32_t i = 0; i < notificationCount && in.ok(); ++i) {
+            UserId recipientId = in.get<UserId>();
+            notifications.send(Notification(in.getString(), recipientId));
+        }
+
+        if (!in.ok()) {
+            throw std::runtime_error("snapshot " + path + " is truncated");
+        }
+    }
+
+    // Parses a whole-number field greater than 0
+    static bool parsePositive(const std::string& field, int& value) {
+        if (field.empty() || field.size() > 9 || field.find_first_not_of("0123456789") != std::string::npos) {
+            return false;
+        }
+        value = std::stoi(field);
+        return value > 0;
+    }
+
+    void handleLoginSignup() {
+        std::cout << "\033[1;32m1. Login\n2. Signup\n3. Exit\033[0m\nEnter your choice: ";
+        int choice;
+        std::cin >> choice;
+
+        switch (choice) {
+            case 1:
+                loggedIn = login(currentUser);
+                break;
+            case 2:
+                signup();
+                break;
+            case 3:
+                shutdown();
+                exit(0);
+            default:
+                throw InvalidArgumentException("\033[1;31mInvalid choice. Try again.\033[0m");
+        }
+    }
+
+    // Role check of console choice C, compiled from its CONSOLE_CHOICES row as
+    // LineServer::admit is from LINE_REQUESTS. Instantiated for every choice, so each
+    // row is checked when the console is compiled. Throws the row's refusal if the
+    // current user may not pick C.
+    template <ConsoleChoice C>
+    void admitChoice() const {
+        constexpr ConsoleChoiceSpec spec = CONSOLE_CHOICES[C];
+        static_assert(spec.choice == C, "CONSOLE_CHOICES rows must follow ConsoleChoice order");
+        static_assert(spec.roles != NO_ROLE && (spec.roles & ~ANY_ROLE) == 0, "console choices need known roles; the menu is only shown after login");
+
+        if constexpr (spec.roles != ANY_ROLE) {
+            if ((currentUser.getRole() & spec.roles) == 0) {
+                throw InvalidArgumentException(std::string("\033[1;31m") + spec.denied + "\033[0m");
+            }
+        }
+    }
+
+    typedef void (FoodApp::*ChoiceAdmission)() const;
+
+    template <size_t... Choices>
+    static constexpr std::array<ChoiceAdmission, sizeof...(Choices)> choiceAdmissions(std::index_sequence<Choices...>) {
+        return {{&FoodApp::admitChoice<static_cast<ConsoleChoice>(Choices)>...}};
+    }
+
+    // What a console menu choice runs once admitted
+    struct MenuAction {
+        ConsoleChoice choice;
+        void (FoodApp::*run)();
+    };
+
+    void handleUserActions() {
+        static constexpr MenuAction MENU[CONSOLE_CHOICE_COUNT] = {
+            {ADD_CHOICE, &FoodApp::addFoodItem},
+            {VIEW_CHOICE, &FoodApp::viewFoodItems},
+            {EXPIRING_CHOICE, &FoodApp::viewExpiringItems},
+            {NOTIFICATIONS_CHOICE, &FoodApp::viewNotifications},
+            {LOGOUT_CHOICE, &FoodApp::logout},
+            {SEARCH_CHOICE, &FoodApp::searchFoodItems},
+            {CLAIM_CHOICE, &FoodApp::claimFoodItem},
+            {ALERTS_CHOICE, &FoodApp::manageAlerts},
+            {LOCATE_CHOICE, &FoodApp::setLocation},
+            {NEAR_CHOICE, &FoodApp::viewNearbyItems}
+        };
+        static_assert([] {
+            for (size_t i = 0; i < CONSOLE_CHOICE_COUNT; ++i) {
+                if (MENU[i].choice != static_cast<ConsoleChoice>(i)) {
+                    return false;
+                }
+            }
+            return true;
+        }(), "MENU rows must follow ConsoleChoice order");
+        static constexpr std::array<ChoiceAdmission, CONSOLE_CHOICE_COUNT> ADMISSIONS = choiceAdmissions(std::make_index_sequence<CONSOLE_CHOICE_COUNT>());
+
+        std::cout << "\033[1;32m";
+        for (const ConsoleChoiceSpec& spec : CONSOLE_CHOICES) {
+            std::cout << (spec.choice == 0 ? "" : "\n") << spec.choice + 1 << ". " << spec.label;
+        }
+        std::cout << "\033[0m\nEnter your choice: ";
+        int choice = 0;
+        std::cin >> choice;
+
+        if (choice < 1 || choice > CONSOLE_CHOICE_COUNT) {
+            throw InvalidArgumentException("\033[1;31mInvalid choice. Try again.\033[0m");
+        }
+        (this->*ADMISSIONS[choice - 1])();
+        (this->*MENU[choice - 1].run)();
+    }
+
+    void logout() {
+        loggedIn = false;
+        currentUser = User("", "", ""); // Clear user data
+    }
+
+    bool login(User& currentUser) {
+        std::string username, password;
+        std::cout << "Enter username: ";
+        std::cin >> username;
+        std::cout << "Enter password: ";
+        std::cin >> password;
+
+        UserId id = authenticate(username, password);
+
+        if (id != NO_USER) {
+            currentUser = users.get(id); // Set the current user
+            std::cout << "\033[1;32mLogin successful. Welcome, " << username << "!\033[0m" << std::endl;
+            return true;
+        } else {
+            std::cout << "\033[1;31mLogin failed. Invalid username or password.\033[0m" << std::endl;
+            return false;
+        }
+    }
+
+    void signup() {
+        std::string username, password, userType;
+        std::cout << "Enter username: ";
+        std::cin >> username;
+
+        if (users.find(username) != nullptr) {
+            throw InvalidArgumentException("\033[1;31mUsername is already in use. Please choose a different username.\033[0m");
+        } else {
+            std::cout << "Enter password: ";
+            std::cin >> password;
+            std::cout << "Enter user type (\033[1;34mpeople\033[0m or \033[1;34mrestaurant\033[0m): ";
+            std::cin >> userType;
+
+            registerUser(User(username, password, userType));
+            std::cout << "\033[1;32mSignup successful. You can now log in.\033[0m" << std::endl;
+        }
+    }
+
+    void addFoodItem() {
+        std::string name;
+        int quantity, daysToExpiration;
+        std::cout << "Enter food item name: ";
+        std::cin >> name;
+        if (name.empty()) {
+            throw InvalidArgumentException("\033[1;31mFood item name cannot be empty.\033[0m");
+        }
+
+        std::cout << "Enter quantity: ";
+        std::cin >> quantity;
+        if (quantity <= 0) {
+            throw InvalidArgumentException("\033[1;31mQuantity must be greater than 0.\033[0m");
+        }
+
+        std::cout << "Enter days to expiration: ";
+        std::cin >> daysToExpiration;
+        if (daysToExpiration <= 0) {
+            throw InvalidArgumentException("\033[1;31mDays to expiration must be greater than 0.\033[0m");
+        }
+
+        listFoodItem(currentUser.getId(), name, quantity, daysToExpiration);
+        std::cout << "\033[1;32mFood item added successfully.\033[0m" << std::endl;
+    }
+
+    void viewFoodItems() {
+        std::cout << "\033[1;34mFood Items:\033[0m" << std::endl;
+
+        // Rendered a page at a time so the store is not locked while the terminal catches up
+        PageCursor cursor;
+        ItemRenderer page(outputFormat, ItemRenderer::OWNED_ITEMS);
+        size_t shown;
+        do {
+            shown = forEachFoodItem(currentUser.getId(), cursor, CONSOLE_PAGE_ROWS, [&page](const FoodItem& item) {
+                page.add(item);
+            });
+            page.flush(std::cout);
+        } while (shown == CONSOLE_PAGE_ROWS);
+    }
+
+    void viewExpiringItems() {
+        int hours;
+        std::cout << "Show items expiring within how many hours: ";
+        std::cin >> hours;
+        if (hours <= 0) {
+            throw InvalidArgumentException("\033[1;31mHours must be greater than 0.\033[0m");
+        }
+
+        std::cout << "\033[1;34mExpiring Food Items:\033[0m" << std::endl;
+        time_t currentTime = time(nullptr);
+        time_t windowEnd = currentTime + static_cast<time_t>(hours) * SECONDS_PER_HOUR;
+
+        PageCursor cursor;
+        ItemRenderer page(outputFormat, ItemRenderer::EXPIRING_ITEMS);
+        size_t shown;
+        do {
+            shown = forEachExpiring(currentTime, windowEnd, cursor, CONSOLE_PAGE_ROWS, [this, &page, currentTime](const FoodItem& item) {
+                page.add(item, users.get(item.getOwnerId()).getUsername(), currentTime);
+            });
+            page.flush(std::cout);
+        } while (shown == CONSOLE_PAGE_ROWS);
+    }
+
+    void searchFoodItems() {
+        std::string query;
+        std::cout << "Search for (end with * to match the start of names): ";
+        std::cin >> query;
+
+        std::cout << "\033[1;34mMatching Food Items:\033[0m" << std::endl;
+        time_t currentTime = time(nullptr);
+        ItemRenderer page(outputFormat, ItemRenderer::EXPIRING_ITEMS);
+        searchFoodItems(query, currentTime, SEARCH_RESULTS, [this, &page, currentTime](const FoodItem& item) {
+            page.add(item, users.get(item.getOwnerId()).getUsername(), currentTime);
+        });
+        page.flush(std::cout);
+    }
+
+    void claimFoodItem() {
+        std::string restaurantName, itemName;
+        int quantity;
+        std::cout << "Enter restaurant name: ";
+        std::cin >> restaurantName;
+        std::cout << "Enter food item name: ";
+        std::cin >> itemName;
+        std::cout << "Enter quantity: ";
+        std::cin >> quantity;
+
+        int taken = claimFoodItem(currentUser.getId(), restaurantName, itemName, quantity);
+        if (taken == 0) {
+            throw InvalidArgumentException("\033[1;31mNo " + itemName + " left at " + restaurantName + ".\033[0m");
+        }
+        std::cout << "\033[1;32mClaimed " << taken << " " << itemName << " from " << restaurantName << ".\033[0m" << std::endl;
+    }
+
+    void setLocation() {
+        Location location;
+        std::cout << "Enter latitude: ";
+        std::cin >> location.latitude;
+        std::cout << "Enter longitude: ";
+        std::cin >> location.longitude;
+        if (!std::cin) {
+            throw InvalidArgumentException("\033[1;31mLatitude and longitude must be numbers.\033[0m");
+        }
+
+        setLocation(currentUser.getId(), location);
+        std::cout << "\033[1;32mLocation saved.\033[0m" << std::endl;
+    }
+
+    void viewNearbyItems() {
+        std::cout << "\033[1;34mFood Near You:\033[0m" << std::endl;
+        forEachNearby(currentUser.getId(), NEARBY_RESTAURANTS, [](const User& restaurant, double km, const FoodItem& item) {
+            std::cout << "\033[1;34mRestaurant:\033[0m " << restaurant.getUsername() << " (" << std::fixed << std::setprecision(1) << km << std::defaultfloat
+                      << " km), \033[1;34mName:\033[0m " << item.getName() << ", \033[1;34mQuantity:\033[0m " << item.getQuantity()
+                      << ", \033[1;34mDays to Expiration:\033[0m " << item.getDaysToExpiration() << "\n";
+        });
+        std::cout << std::flush;
+    }
+
+    void manageAlerts() {
+        std::cout << "\033[1;34mYour alert keywords:\033[0m";
+        for (const std::string& keyword : getSubscriptions(currentUser.getId())) {
+            std::cout << " " << keyword;
+        }
+        std::cout << std::endl << "Enter a keyword to be alerted about (prefix it with - to stop): ";
+        std::string keyword;
+        std::cin >> keyword;
+
+        if (!keyword.empty() && keyword[0] == '-') {
+            if (!unsubscribe(currentUser.getId(), keyword.substr(1))) {
+                throw InvalidArgumentException("\033[1;31mYou are not subscribed to " + keyword.substr(1) + ".\033[0m");
+            }
+            std::cout << "\033[1;32mAlerts for " << keyword.substr(1) << " stopped.\033[0m" << std::endl;
+        } else {
+            subscribe(currentUser.getId(), keyword);
+            std::cout << "\033[1;32mYou will be notified when anyone lists " << keyword << ".\033[0m" << std::endl;
+        }
+    }
+
+    void viewNotifications() {
+        std::cout << "\033[1;34mNotifications:\033[0m" << std::endl;
+        const std::string& recipient = currentUser.getUsername();
+        drainNotifications(currentUser.getId(), [&recipient](const Notification& notification) {
+            std::cout << "\033[1;34mMessage:\033[0m " << notification.getMessage() << ", \033[1;34mRecipient:\033[0m " << recipient << std::endl;
+        });
+    }
+};
+
+#ifdef __linux__
+// Requests of the line protocol. The server checks each request against its row
+// here (word count, session, roles) before running it. The session and role
+// checks are compiled per request from its row (see LineServer::admit), so who
+// may send what is a compile-time constant, and the policy is pinned below.
+enum LineRequest {
+    SIGNUP_REQUEST,
+    LOGIN_REQUEST,
+    AUTH_REQUEST,
+    LOGOUT_REQUEST,
+    ADD_REQUEST,
+    LIST_REQUEST,
+    EXPIRING_REQUEST,
+    MORE_REQUEST,
+    NOTIFICATIONS_REQUEST,
+    SEARCH_REQUEST,
+    CLAIM_REQUEST,
+    SUBSCRIBE_REQUEST,
+    UNSUBSCRIBE_REQUEST,
+    ALERTS_REQUEST,
+    LOCATE_REQUEST,
+    NEAR_REQUEST,
+    REPORT_REQUEST,
+    STATS_REQUEST,
+    BATCH_REQUEST,
+    QUIT_REQUEST,
+    LINE_REQUEST_COUNT
+};
+
+struct LineRequestSpec {
+    LineRequest request;
+    const char* name;
+    uint8_t minWords; // Counting the request name
+    uint8_t maxWords;
+    RoleMask roles;   // Who may send it once logged in; NO_ROLE if it needs no session
+};
+
+constexpr size_t MAX_REQUEST_WORDS = 4;
+
+constexpr LineRequestSpec LINE_REQUESTS[LINE_REQUEST_COUNT] = {
+    {SIGNUP_REQUEST, "SIGNUP", 4, 4, NO_ROLE},
+    {LOGIN_REQUEST, "LOGIN", 3, 3, NO_ROLE},
+    {AUTH_REQUEST, "AUTH", 2, 2, NO_ROLE},
+    {LOGOUT_REQUEST, "LOGOUT", 1, 1, ANY_ROLE},
+    {ADD_REQUEST, "ADD", 4, 4, RESTAURANT_ROLE},
+    {LIST_REQUEST, "LIST", 1, 2, ANY_ROLE},
+    {EXPIRING_REQUEST, "EXPIRING", 2, 2, ANY_ROLE},
+    {MORE_REQUEST, "MORE", 1, 1, ANY_ROLE},
+    {NOTIFICATIONS_REQUEST, "NOTIFICATIONS", 1, 1, ANY_ROLE},
+    {SEARCH_REQUEST, "SEARCH", 2, 2, ANY_ROLE},
+    {CLAIM_REQUEST, "CLAIM", 4, 4, PEOPLE_ROLE},
+    {SUBSCRIBE_REQUEST, "SUBSCRIBE", 2, 2, PEOPLE_ROLE},
+    {UNSUBSCRIBE_REQUEST, "UNSUBSCRIBE", 2, 2, PEOPLE_ROLE},
+    {ALERTS_REQUEST, "ALERTS", 1, 1, PEOPLE_ROLE},
+    {LOCATE_REQUEST, "LOCATE", 3, 3, ANY_ROLE},
+    {NEAR_REQUEST, "NEAR", 1, 2, PEOPLE_ROLE},
+    {REPORT_REQUEST, "REPORT", 1, 1, ANY_ROLE},
+    {STATS_REQUEST, "STATS", 1, 1, ANY_ROLE},
+    {BATCH_REQUEST, "BATCH", 2, 2, NO_ROLE},
+    {QUIT_REQUEST, "QUIT", 1, 1, NO_ROLE}
+};
+
+// Whether a user with this role may send the request; NO_ROLE is a client that has not logged in
+constexpr bool lineRequestAllowed(LineRequest request, Role role) {
+    return LINE_REQUESTS[request].roles == NO_ROLE || (LINE_REQUESTS[request].roles & role) != 0;
+}
+
+static_assert(lineRequestAllowed(SIGNUP_REQUEST, NO_ROLE) && lineRequestAllowed(LOGIN_REQUEST, NO_ROLE), "anyone can sign up and log in");
+static_assert(lineRequestAllowed(ADD_REQUEST, RESTAURANT_ROLE) && !lineRequestAllowed(ADD_REQUEST, PEOPLE_ROLE) && !lineRequestAllowed(ADD_REQUEST, NO_ROLE),
+              "only restaurants list food");
+static_assert(lineRequestAllowed(CLAIM_REQUEST, PEOPLE_ROLE) && !lineRequestAllowed(CLAIM_REQUEST, RESTAURANT_ROLE), "only people claim food");
+static_assert(!lineRequestAllowed(STATS_REQUEST, NO_ROLE) && !lineRequestAllowed(REPORT_REQUEST, NO_ROLE), "metrics and the waste report need a login");
+static_assert(CONSOLE_CHOICES[ADD_CHOICE].roles == LINE_REQUESTS[ADD_REQUEST].roles && CONSOLE_CHOICES[CLAIM_CHOICE].roles == LINE_REQUESTS[CLAIM_REQUEST].roles &&
+              CONSOLE_CHOICES[NOTIFICATIONS_CHOICE].roles == LINE_REQUESTS[NOTIFICATIONS_REQUEST].roles && CONSOLE_CHOICES[NEAR_CHOICE].roles == LINE_REQUESTS[NEAR_REQUEST].roles,
+              "the console and the line protocol agree on who may list, claim, read notifications and look nearby");
+
+// Line protocol for driving the app over a socket, one request per line, words
+// separated by spaces. Requests may be pipelined; replies come back in order.
+//   SIGNUP <username> <password> <people|restaurant>    LOGIN <username> <password>
+//   AUTH <token>                                         LOGOUT
+//   ADD <name> <quantity> <days>                         LIST [restaurant]
+//   EXPIRING <hours>                                     NOTIFICATIONS
+//   MORE                                                 SEARCH <query> (trailing * = prefix)
+//   CLAIM <restaurant> <name> <quantity>                 SUBSCRIBE <keyword>
+//   UNSUBSCRIBE <keyword>                                ALERTS
+//   LOCATE <latitude> <longitude>                        NEAR [k]
+//   REPORT                                               STATS
+//   BATCH <count>                                        QUIT
+// Every reply starts with "OK <rows>" followed by that many tab-separated rows,
+// or is a single "ERR <message>" line. LOGIN replies with a session token that
+// AUTH accepts on a later connection; requests after that never send passwords.
+// LIST and EXPIRING reply with their first PAGE_ROWS rows and MORE continues the
+// last listing; a page shorter than PAGE_ROWS is the last one. CLAIM replies
+// with one row, the number of units actually taken; ALERTS with one row per keyword.
+// NEAR gives the soonest-expiring item of each of the k (default 10, at most
+// PAGE_ROWS) nearest restaurants with stock: restaurant, km, name, quantity, hours.
+// REPORT, like STATS, replies with human-readable lines: the waste report. STATS
+// needs a login too, since it shows user and session counts.
+// BATCH runs the next count (at most MAX_BATCH) requests together with a single
+// log sync: it replies "OK 0" and then their replies in order, once all of them
+// are durable, or a single ERR if they could not be made durable.
+// LINE_REQUESTS says which requests need a login and which roles may send them.
+class LineServer {
+private:
+    static const size_t READ_CHUNK = 64 * 1024;
+    static const size_t MAX_BUFFERED = 4 * 1024 * 1024; // Stop reading a client that does not read its replies
+    static const size_t PAGE_ROWS = 100;
+    static const int MAX_BATCH = 1000;
+
+    enum Listing {
+        NO_LISTING,
+        OWNER_LISTING,
+        EXPIRING_LISTING
+    };
+
+    struct Connection {
+        int fd;
+        SessionToken session = NO_SESSION; // Stays valid across reconnects through AUTH
+        std::string in;    // Unparsed request bytes; the parsed prefix is dropped once per event
+        std::string out;   // Replies not yet accepted by the socket
+        std::string rows;  // Scratch for the reply being built
+        size_t written = 0;
+        bool closing = false;
+
+        // The listing MORE continues
+        Listing listing = NO_LISTING;
+        UserId listingOwner = NO_USER;
+        time_t listingFrom = 0;
+        time_t listingUntil = 0;
+        PageCursor cursor;
+
+        // Lines of a BATCH still arriving, and how many more it needs
+        std::string batch;
+        int batchLeft = 0;
+        bool inBatch = false;
+    };
+
+    FoodApp& app;
+    int listener;
+    int wakeup; // eventfd that interrupts every event loop on stop()
+    std::atomic<bool> stopping;
+    std::vector<std::thread> loops;
+
+    // Messages are shared with the console, so drop its colour codes
+    static void appendPlain(std::string& out, const std::string& message) {
+        for (size_t i = 0; i < message.size(); ++i) {
+            if (message[i] == '\033') {
+                size_t end = message.find('m', i);
+                if (end != std::string::npos) {
+                    i = end;
+                    continue;
+                }
+            }
+            out.push_back(message[i] == '\n' ? ' ' : message[i]);
+        }
+    }
+
+    static void replyError(std::string& out, const std::string& message) {
+        out += "ERR ";
+        appendPlain(out, message);
+        out.push_back('\n');
+    }
+
+    static void replyRows(std::string& out, size_t rows, const std::string& body) {
+        out += "OK ";
+        out += std::to_string(rows);
+        out.push_back('\n');
+        out += body;
+    }
+
+    static size_t splitWords(const char* line, size_t length, std::string* words, size_t maxWords) {
+        size_t count = 0;
+        size_t i = 0;
+        while (i < length) {
+            while (i < length && line[i] == ' ') {
+                ++i;
+            }
+            size_t begin = i;
+            while (i < length && line[i] != ' ') {
+                ++i;
+            }
+            if (i > begin) {
+                if (count == maxWords) {
+                    return maxWords + 1;
+                }
+                words[count++].assign(line + begin, i - begin);
+            }
+        }
+        return count;
+    }
+
+    // Parses a decimal number such as "-33.8688"
+    static bool parseCoordinate(const std::string& word, double& value) {
+        char* end = nullptr;
+        value = strtod(word.c_str(), &end);
+        return !word.empty() && end == word.c_str() + word.size() && std::isfinite(value);
+    }
+
+    static bool parseNumber(const std::string& word, int& value) {
+        if (word.empty() || word.size() > 9 || word.find_first_not_of("0123456789") != std::string::npos) {
+            return false;
+        }
+        value = std::stoi(word);
+        return value > 0;
+    }
+
+    // name, quantity, restaurant, hours left
+    void appendExpiringRow(std::string& rows, const FoodItem& item, time_t currentTime) const {
+        rows += item.getName();
+        rows.push_back('\t');
+        rows += std::to_string(item.getQuantity());
+        rows.push_back('\t');
+        rows += app.getUser(item.getOwnerId()).getUsername();
+        rows.push_back('\t');
+        rows += std::to_string((item.getExpiresAt() - currentTime) / SECONDS_PER_HOUR);
+        rows.push_back('\n');
+    }
+
+    // Appends the next page of the connection's listing, streamed straight from the store
+    void replyPage(Connection& connection) {
+        std::string& rows = connection.rows;
+        rows.clear();
+        size_t count;
+        if (connection.listing == OWNER_LISTING) {
+            count = app.forEachFoodItem(connection.listingOwner, connection.cursor, PAGE_ROWS, [&rows](const FoodItem& item) {
+                rows += item.getName();
+                rows.push_back('\t');
+                rows += std::to_string(item.getQuantity());
+                rows.push_back('\t');
+                rows += std::to_string(item.getDaysToExpiration());
+                rows.push_back('\n');
+            });
+        } else {
+            time_t currentTime = time(nullptr);
+            count = app.forEachExpiring(connection.listingFrom, connection.listingUntil, connection.cursor, PAGE_ROWS, [this, &rows, currentTime](const FoodItem& item) {
+                appendExpiringRow(rows, item, currentTime);
+            });
+        }
+        replyRows(connection.out, count, rows);
+    }
+
+    static const LineRequestSpec* findRequest(const std::string& name) {
+        for (const LineRequestSpec& spec : LINE_REQUESTS) {
+            if (name == spec.name) {
+                return &spec;
+            }
+        }
+        return nullptr;
+    }
+
+    // Session and role checks of request R, compiled from its LINE_REQUESTS row.
+    // Instantiated for every request (see ADMISSIONS), so each row is checked when
+    // the server is compiled. Replies with the refusal and returns false if the
+    // client may not send R; userId is the sender, or NO_USER if R needs no session.
+    template <LineRequest R>
+    bool admit(Connection& connection, UserId& userId) {
+        constexpr LineRequestSpec spec = LINE_REQUESTS[R];
+        static_assert(spec.request == R, "LINE_REQUESTS rows must follow LineRequest order");
+        static_assert(spec.minWords >= 1 && spec.minWords <= spec.maxWords && spec.maxWords <= MAX_REQUEST_WORDS, "word counts must fit in MAX_REQUEST_WORDS");
+        static_assert((spec.roles & ~ANY_ROLE) == 0, "roles must be known roles");
+
+        userId = NO_USER;
+        if constexpr (spec.roles != NO_ROLE) {
+            // Authenticated requests only resolve the token; credentials were checked once at LOGIN
+            userId = connection.session == NO_SESSION ? NO_USER : app.resolveSession(connection.session);
+            if (userId == NO_USER) {
+                replyError(connection.out, connection.session == NO_SESSION ? "login required" : "session expired");
+                connection.session = NO_SESSION;
+                return false;
+            }
+            if constexpr (spec.roles != ANY_ROLE) {
+                if ((app.getUser(userId).getRole() & spec.roles) == 0) {
+                    replyError(connection.out, std::string("only ") + (spec.roles == PEOPLE_ROLE ? "people" : "restaurants") + " can " + spec.name);
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    typedef bool (LineServer::*Admission)(Connection&, UserId&);
+
+    template <size_t... Requests>
+    static constexpr std::array<Admission, sizeof...(Requests)> admissions(std::index_sequence<Requests...>) {
+        return {{&LineServer::admit<static_cast<LineRequest>(Requests)>...}};
+    }
+
+    // Checks a request against its row in LINE_REQUESTS, runs it and appends its
+    // reply. Lines of a BATCH are held until the whole batch has arrived.
+    void handle(Connection& connection, const char* line, size_t length) {
+        std::string& out = connection.out;
+        if (connection.batchLeft > 0) {
+            connection.batch.append(line, length);
+            connection.batch.push_back('\n');
+            if (--connection.batchLeft == 0) {
+                runBatch(connection);
+            } else if (connection.batch.size() > MAX_BUFFERED) {
+                replyError(out, "batch too large");
+                connection.closing = true;
+            }
+            return;
+        }
+
+        std::string words[MAX_REQUEST_WORDS + 1];
+        size_t count = splitWords(line, length, words, MAX_REQUEST_WORDS);
+        if (count == 0) {
+            replyError(out, "empty request");
+            return;
+        }
+        const LineRequestSpec* spec = findRequest(words[0]);
+        if (spec == nullptr || count < spec->minWords || count > spec->maxWords) {
+            replyError(out, "unknown or malformed request");
+            return;
+        }
+
+        static constexpr std::array<Admission, LINE_REQUEST_COUNT> ADMISSIONS = admissions(std::make_index_sequence<LINE_REQUEST_COUNT>());
+        try {
+            UserId userId;
+            if ((this->*ADMISSIONS[spec->request])(connection, userId)) {
+                run(spec->request, connection, words, count, userId);
+            }
+        } catch (const std::exception& e) {
+            replyError(out, e.what());
+        }
+    }
+
+    // Runs a complete batch, then syncs the log once for all of it. Replies stay in
+    // the connection's buffer until then, so none goes out before its change is durable.
+    void runBatch(Connection& connection) {
+        std::string lines;
+        lines.swap(connection.batch);
+        size_t replyStart = connection.out.size();
+        replyRows(connection.out, 0, "");
+        connection.inBatch = true;
+        try {
+            app.batchCommits([this, &connection, &lines] {
+                for (size_t begin = 0; begin < lines.size() && !connection.closing;) {
+                    size_t end = lines.find('\n', begin);
+                    handle(connection, lines.data() + begin, end - begin);
+                    begin = end + 1;
+                }
+            });
+        } catch (const std::exception& e) {
+            connection.out.resize(replyStart);
+            replyError(connection.out, e.what());
+        }
+        connection.inBatch = false;
+    }
+
+    // Runs a request that passed its LINE_REQUESTS checks; userId is NO_USER for
+    // requests that need no session
+    void run(LineRequest request, Connection& connection, const std::string* words, size_t count, UserId userId) {
+        std::string& out = connection.out;
+        switch (request) {
+            case SIGNUP_REQUEST:
+                app.registerUser(User(words[1], words[2], words[3]));
+                replyRows(out, 0, "");
+                break;
+            case LOGIN_REQUEST: {
+                SessionToken session = app.openSession(words[1], words[2]);
+                if (session == NO_SESSION) {
+                    replyError(out, "invalid username or password");
+                } else {
+                    if (connection.session != NO_SESSION) {
+                        app.closeSession(connection.session);
+                    }
+                    connection.session = session;
+                    char token[17];
+                    snprintf(token, sizeof(token), "%016llx", static_cast<unsigned long long>(session));
+                    replyRows(out, 1, std::string(token) + "\n");
+                }
+                break;
+            }
+            case AUTH_REQUEST: {
+                SessionToken session = words[1].size() == 16 && words[1].find_first_not_of("0123456789abcdef") == std::string::npos ? std::stoull(words[1], nullptr, 16) : NO_SESSION;
+                if (app.resolveSession(session) == NO_USER) {
+                    replyError(out, "unknown or expired session");
+                } else {
+                    connection.session = session;
+                    replyRows(out, 0, "");
+                }
+                break;
+            }
+            case LOGOUT_REQUEST:
+                app.closeSession(connection.session);
+                connection.session = NO_SESSION;
+                replyRows(out, 0, "");
+                break;
+            case ADD_REQUEST: {
+                int quantity, days;
+                if (!parseNumber(words[2], quantity) || !parseNumber(words[3], days)) {
+                    replyError(out, "quantity and days must be whole numbers greater than 0");
+                } else {
+                    app.listFoodItem(userId, words[1], quantity, days);
+                    replyRows(out, 0, "");
+                }
+                break;
+            }
+            case LIST_REQUEST: {
+                UserId ownerId = count == 2 ? app.findUser(words[1]) : userId;
+                if (ownerId == NO_USER) {
+                    replyError(out, "unknown restaurant");
+                    break;
+                }
+                connection.listing = OWNER_LISTING;
+                connection.listingOwner = ownerId;
+                connection.cursor = PageCursor();
+                replyPage(connection);
+                break;
+            }
+            case EXPIRING_REQUEST: {
+                int hours;
+                if (!parseNumber(words[1], hours)) {
+                    replyError(out, "hours must be a whole number greater than 0");
+                    break;
+                }
+                connection.listing = EXPIRING_LISTING;
+                connection.listingFrom = time(nullptr);
+                connection.listingUntil = connection.listingFrom + static_cast<time_t>(hours) * SECONDS_PER_HOUR;
+                connection.cursor = PageCursor();
+                replyPage(connection);
+                break;
+            }
+            case MORE_REQUEST:
+                if (connection.listing == NO_LISTING) {
+                    replyError(out, "no listing to continue");
+                    break;
+                }
+                replyPage(connection);
+                break;
+            case NOTIFICATIONS_REQUEST: {
+                std::string& rows = connection.rows;
+                rows.clear();
+                size_t drained = app.drainNotifications(userId, [&rows](const Notification& notification) {
+                    appendPlain(rows, notification.getMessage());
+                    rows.push_back('\n');
+                });
+                replyRows(out, drained, rows);
+                break;
+            }
+            case SEARCH_REQUEST: {
+                std::string& rows = connection.rows;
+                rows.clear();
+                time_t currentTime = time(nullptr);
+                size_t found = app.searchFoodItems(words[1], currentTime, PAGE_ROWS, [this, &rows, currentTime](const FoodItem& item) {
+                    appendExpiringRow(rows, item, currentTime);
+                });
+                replyRows(out, found, rows);
+                break;
+            }
+            case CLAIM_REQUEST: {
+                int quantity;
+                if (!parseNumber(words[3], quantity)) {
+                    replyError(out, "quantity must be a whole number greater than 0");
+                    break;
+                }
+                int taken = app.claimFoodItem(userId, words[1], words[2], quantity);
+                if (taken == 0) {
+                    replyError(out, "none left");
+                    break;
+                }
+                replyRows(out, 1, std::to_string(taken) + "\n");
+                break;
+            }
+            case SUBSCRIBE_REQUEST:
+                app.subscribe(userId, words[1]);
+                replyRows(out, 0, "");
+                break;
+            case UNSUBSCRIBE_REQUEST:
+                if (!app.unsubscribe(userId, words[1])) {
+                    replyError(out, "not subscribed");
+                    break;
+                }
+                replyRows(out, 0, "");
+                break;
+            case ALERTS_REQUEST: {
+                std::string& rows = connection.rows;
+                rows.clear();
+                std::vector<std::string> keywords = app.getSubscriptions(userId);
+                for (const std::string& keyword : keywords) {
+                    rows += keyword;
+                    rows.push_back('\n');
+                }
+                replyRows(out, keywords.size(), rows);
+                break;
+            }
+            case LOCATE_REQUEST: {
+                Location location;
+                if (!parseCoordinate(words[1], location.latitude) || !parseCoordinate(words[2], location.longitude)) {
+                    replyError(out, "latitude and longitude must be numbers");
+                    break;
+                }
+                app.setLocation(userId, location);
+                replyRows(out, 0, "");
+                break;
+            }
+            case NEAR_REQUEST: {
+                int k = 10;
+                if (count == 2 && (!parseNumber(words[1], k) || static_cast<size_t>(k) > PAGE_ROWS)) {
+                    replyError(out, "k must be a whole number from 1 to " + std::to_string(PAGE_ROWS));
+                    break;
+                }
+                std::string& rows = connection.rows;
+                rows.clear();
+                time_t currentTime = time(nullptr);
+                size_t found = app.forEachNearby(userId, static_cast<size_t>(k), [&rows, currentTime](const User& restaurant, double km, const FoodItem& item) {
+                    char distance[32];
+                    snprintf(distance, sizeof(distance), "%.2f", km);
+                    rows += restaurant.getUsername();
+                    rows.push_back('\t');
+                    rows += distance;
+                    rows.push_back('\t');
+                    rows += item.getName();
+                    rows.push_back('\t');
+                    rows += std::to_string(item.getQuantity());
+                    rows.push_back('\t');
+                    rows += std::to_string((item.getExpiresAt() - currentTime) / SECONDS_PER_HOUR);
+                    rows.push_back('\n');
+                });
+                replyRows(out, found, rows);
+                break;
+            }
+            case REPORT_REQUEST: {
+                std::ostringstream report;
+                app.writeWasteReport(report);
+                std::string text = report.str();
+                replyRows(out, static_cast<size_t>(std::count(text.begin(), text.end(), '\n')), text);
+                break;
+            }
+            case STATS_REQUEST: {
+                std::ostringstream dump;
+                app.dumpMetrics(dump);
+                std::string text = dump.str();
+                replyRows(out, static_cast<size_t>(std::count(text.begin(), text.end(), '\n')), text);
+                break;
+            }
+            case BATCH_REQUEST: {
+                int requests;
+                if (connection.inBatch) {
+                    replyError(out, "batches cannot nest");
+                } else if (!parseNumber(words[1], requests) || requests > MAX_BATCH) {
+                    replyError(out, "batch size must be a whole number from 1 to " + std::to_string(MAX_BATCH));
+                } else {
+                    connection.batchLeft = requests; // The reply comes once the batch has run
+                }
+                break;
+            }
+            case QUIT_REQUEST:
+                replyRows(out, 0, "");
+                connection.closing = true;
+                break;
+            case LINE_REQUEST_COUNT:
+                break;
+        }
+    }
+
+    // Reads what the socket has, answers every complete request, and writes the
+    // replies back; returns false once the connection should be closed
+    bool service(Connection& connection) {
+        while (true) {
+            bool peerClosed = false;
+            while (connection.in.size() < MAX_BUFFERED && connection.out.size() - connection.written < MAX_BUFFERED) {
+                size_t filled = connection.in.size();
+                connection.in.resize(filled + READ_CHUNK);
+                ssize_t got = read(connection.fd, &connection.in[filled], READ_CHUNK);
+                connection.in.resize(filled + std::max<ssize_t>(got, 0));
+                if (got == 0) {
+                    peerClosed = true;
+                    break;
+                }
+                if (got < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                        return false;
+                    }
+                    break;
+                }
+            }
+
+            size_t parsed = 0;
+            while (!connection.closing && connection.out.size() - connection.written < MAX_BUFFERED) {
+                size_t newline = connection.in.find('\n', parsed);
+                if (newline == std::string::npos) {
+                    break;
+                }
+                size_t length = newline - parsed;
+                if (length > 0 && connection.in[newline - 1] == '\r') {
+                    --length;
+                }
+                handle(connection, connection.in.data() + parsed, length);
+                parsed = newline + 1;
+            }
+            connection.in.erase(0, parsed);
+            if (connection.in.size() >= MAX_BUFFERED && connection.in.find('\n') == std::string::npos) {
+                return false; // A request longer than the whole buffer
+            }
+
+            while (connection.written < connection.out.size()) {
+                ssize_t sent = send(connection.fd, connection.out.data() + connection.written, connection.out.size() - connection.written, MSG_NOSIGNAL);
+                if (sent < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                        return false;
+                    }
+                    break;
+                }
+                connection.written += static_cast<size_t>(sent);
+            }
+            bool drained = connection.written == connection.out.size();
+            if (drained) {
+                connection.out.clear();
+                connection.written = 0;
+            }
+
+            if (connection.closing || peerClosed) {
+                return !drained;
+            }
+            // Stop once waiting on the socket; a buffered request left by backpressure needs another pass
+            if (!drained || connection.in.find('\n') == std::string::npos) {
+                return true;
+            }
+        }
+    }
+
+    void eventLoop() {
+        int epoll = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll < 0) {
+            std::cerr << "\033[1;31mError: epoll_create1 failed\033[0m" << std::endl;
+            return;
+        }
+
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLEXCLUSIVE;
+        event.data.ptr = &listener;
+        epoll_ctl(epoll, EPOLL_CTL_ADD, listener, &event);
+        event.events = EPOLLIN;
+        event.data.ptr = &wakeup;
+        epoll_ctl(epoll, EPOLL_CTL_ADD, wakeup, &event);
+
+        std::unordered_map<int, std::unique_ptr<Connection>> connections;
+        epoll_event ready[128];
+        while (!stopping) {
+            int count = epoll_wait(epoll, ready, 128, -1);
+            for (int i = 0; i < count; ++i) {
+                if (ready[i].data.ptr == &wakeup) {
+                    continue;
+                }
+                if (ready[i].data.ptr == &listener) {
+                    int fd;
+                    while ((fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                        int noDelay = 1;
+                        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+                        std::unique_ptr<Connection> connection(new Connection());
+                        connection->fd = fd;
+                        epoll_event client{};
+                        client.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+                        client.data.ptr = connection.get();
+                        epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &client);
+                        connections[fd] = std::move(connection);
+                    }
+                    continue;
+                }
+
+                Connection* connection = static_cast<Connection*>(ready[i].data.ptr);
+                if ((ready[i].events & EPOLLERR) || !service(*connection)) {
+                    int fd = connection->fd;
+                    epoll_ctl(epoll, EPOLL_CTL_DEL, fd, nullptr);
+                    close(fd);
+                    connections.erase(fd);
+                }
+            }
+        }
+
+        for (auto& entry : connections) {
+            close(entry.first);
+        }
+        close(epoll);
+    }
+
+public:
+    explicit LineServer(FoodApp& app) : app(app), listener(-1), wakeup(-1), stopping(false) {}
+
+    ~LineServer() {
+        stop();
+        if (listener >= 0) {
+            close(listener);
+        }
+        if (wakeup >= 0) {
+            close(wakeup);
+        }
+    }
+
+    LineServer(const LineServer&) = delete;
+    LineServer& operator=(const LineServer&) = delete;
+
+    // Binds to 127.0.0.1:port (0 picks a free port) and returns the bound port
+    uint16_t listen(uint16_t port) {
+        listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int reuse = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = htons(port);
+        socklen_t addressLength = sizeof(address);
+        if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            ::listen(listener, SOMAXCONN) != 0 || getsockname(listener, reinterpret_cast<sockaddr*>(&address), &addressLength) != 0) {
+            throw std::runtime_error("cannot listen on port " + std::to_string(port) + ": " + strerror(errno));
+        }
+        wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        return ntohs(address.sin_port);
+    }
+
+    // Starts one event loop per thread; connections stay with the loop that accepted them
+    void start(size_t threads) {
+        for (size_t i = 0; i < std::max<size_t>(threads, 1); ++i) {
+            loops.emplace_back(&LineServer::eventLoop, this);
+        }
+    }
+
+    // Async-signal-safe, so a signal handler may call it; join() does the waiting
+    void requestStop() {
+        stopping = true;
+        uint64_t one = 1;
+        ssize_t ignored = write(wakeup, &one, sizeof(one));
+        (void)ignored;
+    }
+
+    void join() {
+        for (std::thread& loop : loops) {
+            loop.join();
+        }
+        loops.clear();
+    }
+
+    void stop() {
+        if (!loops.empty()) {
+            requestStop();
+            join();
+        }
+    }
+};
+#endif
+
+// Benchmarks, run with "--bench". Datasets are synthetic and seeded so runs are comparable.
+
+// Heap allocations and frees made by each thread, counted by the replacement operator new
+// below so benchmarks and self-tests can check which paths allocate. The array and
+// nothrow forms of new and delete forward to these. Only builds with
+// -DFOODGUARD_COUNT_ALLOCATIONS replace them; the server keeps the library's.
+#ifdef FOODGUARD_COUNT_ALLOCATIONS
+thread_local size_t threadAllocations = 0;
+thread_local size_t threadDeallocations = 0;
+
+void* operator new(std::size_t size) {
+    ++threadAllocations;
+    if (void* memory = std::malloc(size == 0 ? 1 : size)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+// GCC flags free() on memory from operator new once these are inlined, though here they pair up
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* memory) noexcept {
+    threadDeallocations += memory != nullptr;
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept {
+    threadDeallocations += memory != nullptr;
+    std::free(memory);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+// Listing one restaurant's items should cost the same however many other restaurants exist
+void benchOwnerIndex() {
+    const int TARGET_ITEMS = 100;
+    const int ITEMS_PER_OTHER_RESTAURANT = 10;
+    const int LOOKUPS = 2000;
+    const int ROUNDS = 5; // The best round is reported, so a noisy neighbour does not pass for growth
+
+    std::cout << "getFoodItems(owner) with " << TARGET_ITEMS << " owned items, and the same walk without copying them" << std::endl;
+    std::cout << "other restaurants    total items    ns/lookup    ns/walk" << std::endl;
+
+    for (int otherRestaurants : {10, 100, 1000, 10000, 100000}) {
+        std::mt19937 rng(42);
+        FoodItemBST bst;
+        const UserId target = 0;
+        time_t now = time(nullptr);
+
+        std::vector<FoodItem> items;
+        for (int i = 0; i < TARGET_ITEMS; ++i) {
+            items.emplace_back("item" + std::to_string(rng()) + "_" + std::to_string(items.size()), 1, now, target);
+        }
+        for (int r = 0; r < otherRestaurants; ++r) {
+            const UserId other = static_cast<UserId>(r + 1);
+            for (int i = 0; i < ITEMS_PER_OTHER_RESTAURANT; ++i) {
+                items.emplace_back("item" + std::to_string(rng()) + "_" + std::to_string(items.size()), 1, now, other);
+            }
+        }
+        std::shuffle(items.begin(), items.end(), rng);
+        for (const FoodItem& item : items) {
+            bst.insert(item);
+        }
+
+        // Copies come from getFoodItems; the walk streams the same items by reference
+        size_t found = 0, walked = 0;
+        long long lookupNanos = 0, walkNanos = 0;
+        for (int round = 0; round < ROUNDS; ++round) {
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < LOOKUPS; ++i) {
+                found += bst.getFoodItems(target).size();
+            }
+            auto middle = std::chrono::steady_clock::now();
+            for (int i = 0; i < LOOKUPS; ++i) {
+                PageCursor cursor;
+                walked += bst.forEachFoodItem(target, cursor, TARGET_ITEMS, [&walked](const FoodItem& item) {
+                    walked += item.getQuantity() == 0;
+                });
+            }
+            auto end = std::chrono::steady_clock::now();
+            long long lookup = std::chrono::duration_cast<std::chrono::nanoseconds>(middle - start).count() / LOOKUPS;
+            long long walk = std::chrono::duration_cast<std::chrono::nanoseconds>(end - middle).count() / LOOKUPS;
+            lookupNanos = round == 0 ? lookup : std::min(lookupNanos, lookup);
+            walkNanos = round == 0 ? walk : std::min(walkNanos, walk);
+        }
+
+        if (found != static_cast<size_t>(TARGET_ITEMS) * LOOKUPS * ROUNDS || walked != found) {
+            std::cerr << "owner index returned " << found / LOOKUPS / ROUNDS << " items, expected " << TARGET_ITEMS << std::endl;
+        }
+        std::cout << std::setw(17) << otherRestaurants << std::setw(15) << items.size() << std::setw(13) << lookupNanos << std::setw(11) << walkNanos << std::endl;
+    }
+}
+
+// One screen of a large restaurant's listing: copying the whole list vs streaming a page from a cursor
+void benchPaging() {
+    const int OWNED = 100000;
+    const size_t PAGE = 20;
+    const int REQUESTS = 200;
+
+    std::cout << std::endl << "one " << PAGE << "-row page of a restaurant with " << OWNED << " items" << std::endl;
+
+    std::mt19937 rng(42);
+    FoodItemBST bst;
+    std::vector<FoodItem> items;
+    time_t now = time(nullptr);
+    for (int i = 0; i < OWNED; ++i) {
+        items.emplace_back("item" + std::to_string(rng()), 1, now, 0);
+    }
+    bst.insertBatch(std::move(items));
+
+    // Resume from the middle of the listing, as a client paging through it would
+    PageCursor middle;
+    bst.forEachFoodItem(0, middle, OWNED / 2, [](const FoodItem&) {});
+
+    size_t rows = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < REQUESTS; ++i) {
+        std::vector<FoodItem> all = bst.getFoodItems(0);
+        rows += std::min(all.size(), PAGE);
+    }
+    auto copyTime = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < REQUESTS; ++i) {
+        PageCursor cursor = middle;
+        rows += bst.forEachFoodItem(0, cursor, PAGE, [](const FoodItem& item) {
+            (void)item.getQuantity();
+        });
+    }
+    auto pageTime = std::chrono::steady_clock::now() - start;
+
+    if (rows != PAGE * REQUESTS * 2) {
+        std::cerr << "paging returned " << rows << " rows, expected " << PAGE * REQUESTS * 2 << std::endl;
+    }
+    auto nanos = [](std::chrono::steady_clock::duration d) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+    };
+    std::cout << "copy full list:       " << nanos(copyTime) / REQUESTS << " ns/page" << std::endl;
+    std::cout << "cursor page:          " << nanos(pageTime) / REQUESTS << " ns/page" << std::endl;
+}
+
+// Rows per second for each listing format, written to /dev/null, against the old per-row std::endl output
+void benchRenderer() {
+    const int ROWS = 1000000;
+    const int BATCH = 100;
+
+    std::cout << std::endl << "rendering " << ROWS << " expiring-item rows to /dev/null" << std::endl;
+
+    std::mt19937 rng(42);
+    time_t now = time(nullptr);
+    std::vector<FoodItem> items;
+    for (int i = 0; i < 1000; ++i) {
+        items.emplace_back("item" + std::to_string(rng() % 100000), 1 + static_cast<int>(rng() % 50), now + static_cast<time_t>(rng() % 72) * SECONDS_PER_HOUR, 0);
+    }
+    const std::string restaurant = "restaurant42";
+    std::ofstream sink("/dev/null", std::ios::binary);
+
+    auto report = [](const char* label, std::chrono::steady_clock::duration elapsed) {
+        double seconds = std::chrono::duration<double>(elapsed).count();
+        std::cout << label << static_cast<long long>(ROWS / seconds) << " rows/s" << std::endl;
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ROWS; ++i) {
+        const FoodItem& item = items[i % items.size()];
+        sink << "\033[1;34mName:\033[0m " << item.getName() << ", \033[1;34mQuantity:\033[0m " << item.getQuantity() << ", \033[1;34mRestaurant:\033[0m " << restaurant << ", \033[1;34mExpiration in\033[0m " << (item.getExpiresAt() - now) / SECONDS_PER_HOUR << " hours" << std::endl;
+    }
+    report("operator<< + endl:    ", std::chrono::steady_clock::now() - start);
+
+    const std::pair<const char*, OutputFormat> formats[] = {
+        {"plain, batched:       ", PLAIN_OUTPUT},
+        {"json lines, batched:  ", JSON_OUTPUT},
+        {"columnar, batched:    ", COLUMNAR_OUTPUT}
+    };
+    for (const auto& format : formats) {
+        ItemRenderer renderer(format.second, ItemRenderer::EXPIRING_ITEMS);
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < ROWS; ++i) {
+            renderer.add(items[i % items.size()], restaurant, now);
+            if (renderer.rows() == BATCH) {
+                renderer.flush(sink);
+            }
+        }
+        renderer.flush(sink);
+        report(format.first, std::chrono::steady_clock::now() - start);
+    }
+}
+
+#ifdef FOODGUARD_COUNT_ALLOCATIONS
+// Listings of items whose names are longer than the small-string buffer, so any
+// copy of one per item would allocate; shared by the benchmark and the self-test
+class ReadAllocationFixture {
+private:
+    FoodApp app;
+    std::vector<UserId> restaurants;
+    std::ofstream sink;
+    time_t now;
+
+public:
+    ReadAllocationFixture(int restaurantCount, int itemCount) : sink("/dev/null", std::ios::binary), now(time(nullptr)) {
+        std::mt19937 rng(42);
+        for (int r = 0; r < restaurantCount; ++r) {
+            restaurants.push_back(app.registerUser(Restaurant("neighbourhood restaurant " + std::to_string(r), "pw")));
+        }
+        for (int i = 0; i < itemCount; ++i) {
+            app.listFoodItem(restaurants[i % restaurantCount], "organic sourdough loaf " + std::to_string(rng() % 100000), 1 + static_cast<int>(rng() % 50), 1 + static_cast<int>(rng() % 14));
+        }
+    }
+
+    // Listings one walk pages through: every restaurant's, or the one expiring listing
+    size_t listings(bool expiring) const {
+        return expiring ? 1 : restaurants.size();
+    }
+
+    // Pages through the listings with pageRows-row pages, rendering each page; returns (pages, items)
+    std::pair<size_t, size_t> walk(bool expiring, ItemRenderer& renderer, size_t pageRows) {
+        size_t pages = 0, items = 0, rows;
+        if (expiring) {
+            PageCursor cursor;
+            do {
+                rows = app.forEachExpiring(now, now + 15 * SECONDS_PER_DAY, cursor, pageRows, [this, &renderer](const FoodItem& item) {
+                    renderer.add(item, app.getUser(item.getOwnerId()).getUsername(), now);
+                });
+                renderer.flush(sink);
+                ++pages;
+                items += rows;
+            } while (rows == pageRows);
+        } else {
+            for (UserId restaurant : restaurants) {
+                PageCursor cursor;
+                do {
+                    rows = app.forEachFoodItem(restaurant, cursor, pageRows, [&renderer](const FoodItem& item) {
+                        renderer.add(item);
+                    });
+                    renderer.flush(sink);
+                    ++pages;
+                    items += rows;
+                } while (rows == pageRows);
+            }
+        }
+        return std::make_pair(pages, items);
+    }
+};
+
+const std::pair<const char*, OutputFormat> RENDER_FORMATS[] = {{"plain", PLAIN_OUTPUT}, {"json", JSON_OUTPUT}, {"columnar", COLUMNAR_OUTPUT}};
+
+// Heap allocations while paging through listings and rendering them, at two page
+// sizes. Pages allocate nothing; a fresh cursor copies its first name once.
+void benchReadAllocations() {
+    const int RESTAURANTS = 20;
+    const int ITEMS = 20000;
+    const size_t PAGE_SIZES[] = {100, 1000};
+
+    std::cout << std::endl << "heap allocations paging through " << ITEMS << " items with long names" << std::endl;
+    std::cout << "listing    format     page rows   allocs/page   allocs/item" << std::endl;
+
+    ReadAllocationFixture fixture(RESTAURANTS, ITEMS);
+    for (bool expiring : {false, true}) {
+        for (const auto& format : RENDER_FORMATS) {
+            ItemRenderer renderer(format.second, expiring ? ItemRenderer::EXPIRING_ITEMS : ItemRenderer::OWNED_ITEMS);
+            fixture.walk(expiring, renderer, PAGE_SIZES[1]); // Grows the renderer's buffers to their working size
+
+            for (size_t pageRows : PAGE_SIZES) {
+                size_t before = threadAllocations;
+                std::pair<size_t, size_t> walked = fixture.walk(expiring, renderer, pageRows);
+                size_t allocations = threadAllocations - before;
+                std::cout << std::left << std::setw(11) << (expiring ? "expiring" : "owner") << std::setw(11) << format.first << std::right << std::setw(9) << pageRows
+                          << std::setw(14) << static_cast<double>(allocations) / walked.first << std::setw(14) << static_cast<double>(allocations) / walked.second << std::endl;
+            }
+        }
+    }
+}
+#endif
+
+// Name index insert and full-scan cost for sorted (restaurant export) and random feeds
+void benchNameIndex() {
+    std::cout << std::endl << "name index: B+-tree vs std::multimap" << std::endl;
+    std::cout << "     items   order    btree ns/insert  map ns/insert   btree ns/scan  map ns/scan" << std::endl;
+
+    for (size_t count : {100000, 1000000}) {
+        std::vector<std::string> names;
+        names.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            char name[32]; // Fits any size_t, so -Wformat-truncation has nothing to flag
+            snprintf(name, sizeof(name), "item%08zu", i);
+            names.push_back(name);
+        }
+
+        for (bool sorted : {true, false}) {
+            if (!sorted) {
+                std::mt19937 rng(42);
+                std::shuffle(names.begin(), names.end(), rng);
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            BPlusTree<std::string, size_t> tree;
+            for (size_t i = 0; i < count; ++i) {
+                tree.insert(names[i], i);
+            }
+            auto treeInsert = std::chrono::steady_clock::now() - start;
+
+            start = std::chrono::steady_clock::now();
+            std::multimap<std::string, size_t> reference;
+            for (size_t i = 0; i < count; ++i) {
+                reference.emplace(names[i], i);
+            }
+            auto mapInsert = std::chrono::steady_clock::now() - start;
+
+            size_t checksum = 0;
+            start = std::chrono::steady_clock::now();
+            for (auto it = tree.begin(); it != tree.end(); ++it) {
+                checksum += it.value();
+            }
+            auto treeScan = std::chrono::steady_clock::now() - start;
+
+            start = std::chrono::steady_clock::now();
+            for (const auto& entry : reference) {
+                checksum -= entry.second;
+            }
+            auto mapScan = std::chrono::steady_clock::now() - start;
+
+            if (checksum != 0 || tree.size() != reference.size()) {
+                std::cerr << "name index disagrees with reference" << std::endl;
+            }
+
+            auto perItem = [count](std::chrono::steady_clock::duration d) {
+                return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count() / static_cast<long long>(count);
+            };
+            std::cout << std::setw(10) << count << std::setw(8) << (sorted ? "sorted" : "random")
+                      << std::setw(19) << perItem(treeInsert) << std::setw(15) << perItem(mapInsert)
+                      << std::setw(16) << perItem(treeScan) << std::setw(13) << perItem(mapScan) << std::endl;
+        }
+    }
+}
+
+// Top-k name search against a scan over every listing, checking both return the same expiries
+void benchSearch() {
+    const size_t COUNT = 1000000;
+    const size_t K = 10;
+    const int QUERIES = 200;
+    const char* adjectives[] = {"fresh", "day-old", "spicy", "roast", "smoked", "sweet", "garlic", "grilled"};
+    const char* foods[] = {"chicken", "bread", "salad", "salmon", "sandwich", "soup", "rice", "noodles", "bagel", "muffin", "curry", "chickpeas"};
+
+    std::cout << std::endl << "name search over " << COUNT << " listings, top " << K << std::endl;
+    std::cout << "  query          index us/query   scan us/query" << std::endl;
+
+    std::mt19937 rng(42);
+    time_t now = time(nullptr);
+    FoodItemBST bst;
+    std::vector<FoodItem> items;
+    std::vector<std::pair<std::string, time_t>> listings;
+    items.reserve(COUNT);
+    listings.reserve(COUNT);
+    for (size_t i = 0; i < COUNT; ++i) {
+        std::string name = std::string(adjectives[rng() % 8]) + " " + foods[rng() % 12] + " " + std::to_string(rng() % 1000);
+        time_t expiresAt = now - SECONDS_PER_DAY + static_cast<time_t>(rng() % (8 * SECONDS_PER_DAY));
+        listings.emplace_back(name, expiresAt);
+        items.emplace_back(name, 1, expiresAt, static_cast<int>(i % 1000));
+    }
+    bst.insertBatch(std::move(items));
+
+    for (const char* query : {"grilled*", "smoked sal*", "bread", "sal", "noodles 42"}) {
+        std::string needle = query;
+        bool prefix = needle.back() == '*';
+        if (prefix) {
+            needle.pop_back();
+        }
+
+        std::vector<std::pair<time_t, ItemHandle>> found;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < QUERIES; ++i) {
+            found = bst.search(query, now, K);
+        }
+        auto indexTime = std::chrono::steady_clock::now() - start;
+
+        std::vector<time_t> scanned;
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < QUERIES; ++i) {
+            scanned.clear();
+            for (const auto& listing : listings) {
+                size_t at = listing.first.find(needle);
+                if (listing.second >= now && at != std::string::npos && (!prefix || at == 0)) {
+                    scanned.push_back(listing.second);
+                }
+            }
+            size_t keep = std::min(K, scanned.size());
+            std::partial_sort(scanned.begin(), scanned.begin() + keep, scanned.end());
+            scanned.resize(keep);
+        }
+        auto scanTime = std::chrono::steady_clock::now() - start;
+
+        bool agree = found.size() == scanned.size();
+        for (size_t i = 0; agree && i < found.size(); ++i) {
+            agree = found[i].first == scanned[i];
+        }
+        if (!agree) {
+            std::cerr << "search for \"" << query << "\" disagrees with a full scan" << std::endl;
+        }
+
+        auto micros = [](std::chrono::steady_clock::duration d) {
+            return std::chrono::duration_cast<std::chrono::microseconds>(d).count() / QUERIES;
+        };
+        std::cout << "  " << std::left << std::setw(15) << query << std::right
+                  << std::setw(16) << micros(indexTime) << std::setw(16) << micros(scanTime) << std::endl;
+    }
+}
+
+// Builds, scans and tears down a B+-tree over keys using the given node allocator
+template <typename Key, typename NodeAllocator>
+void benchTreeAllocator(const char* label, const std::vector<Key>& keys) {
+    auto nanos = [&keys](std::chrono::steady_clock::duration d) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count() / static_cast<long long>(keys.size());
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    auto* tree = new BPlusTree<Key, size_t, NodeAllocator>();
+    for (size_t i = 0; i < keys.size(); ++i) {
+        tree->insert(keys[i], i);
+    }
+    auto build = std::chrono::steady_clock::now() - start;
+
+    size_t checksum = 0;
+    start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < 5; ++pass) {
+        for (auto it = tree->begin(); it != tree->end(); ++it) {
+            checksum += it.value();
+        }
+    }
+    auto scan = (std::chrono::steady_clock::now() - start) / 5;
+
+    size_t nodes = tree->nodeCount();
+    size_t allocations = tree->heapAllocations();
+    start = std::chrono::steady_clock::now();
+    delete tree;
+    auto teardown = std::chrono::steady_clock::now() - start;
+
+    if (checksum != 5 * (keys.size() * (keys.size() - 1) / 2)) {
+        std::cerr << "tree scan checksum mismatch" << std::endl;
+    }
+    std::cout << std::setw(22) << label << std::setw(10) << nodes << std::setw(13) << allocations
+              << std::setw(10) << nanos(build) << std::setw(9) << nanos(scan) << std::setw(13) << nanos(teardown) << std::endl;
+}
+
+// Index nodes from NodePool chunks vs one global-heap allocation per node, 1M random inserts
+void benchNodePool() {
+    const size_t COUNT = 1000000;
+    std::mt19937_64 rng(42);
+    std::vector<uint64_t> numbers;
+    std::vector<std::string> names;
+    for (size_t i = 0; i < COUNT; ++i) {
+        numbers.push_back(rng());
+        names.push_back("item" + std::to_string(numbers.back() % 100000000));
+    }
+
+    std::cout << std::endl << "B+-tree node allocation, " << COUNT << " random inserts (ns per item)" << std::endl;
+    std::cout << "                          nodes  allocations     build     scan     teardown" << std::endl;
+    benchTreeAllocator<std::string, NodePool>("string keys, pool", names);
+    benchTreeAllocator<std::string, HeapNodeAllocator>("string keys, heap", names);
+    benchTreeAllocator<uint64_t, NodePool>("integer keys, pool", numbers);
+    benchTreeAllocator<uint64_t, HeapNodeAllocator>("integer keys, heap", numbers);
+}
+
+// Bulk ingest throughput from a CSV feed into an empty store and into one already holding the same amount
+void benchIngest() {
+    const int RESTAURANTS = 1000;
+    const size_t RECORDS = 1000000;
+
+    std::cout << std::endl << "bulk ingest of " << RECORDS << " records from " << RESTAURANTS << " restaurants" << std::endl;
+
+    FoodApp app;
+    for (int r = 0; r < RESTAURANTS; ++r) {
+        app.registerUser(Restaurant("restaurant" + std::to_string(r), "pw"));
+    }
+
+    for (int round = 0; round < 2; ++round) {
+        std::mt19937 rng(42 + round);
+        std::string feed;
+        for (size_t i = 0; i < RECORDS; ++i) {
+            feed += "restaurant" + std::to_string(i * RESTAURANTS / RECORDS) + ",item" + std::to_string(rng() % 1000000)
+                  + "," + std::to_string(1 + rng() % 50) + "," + std::to_string(1 + rng() % 14) + "\n";
+        }
+
+        std::istringstream in(feed);
+        std::cout << (round == 0 ? "empty store:    " : "populated store: ");
+        app.ingest(in, std::cout);
+    }
+}
+
+// Restart time with 1M items, from the binary snapshot and from replaying the write-ahead log alone
+void benchRestart() {
+    const int RESTAURANTS = 1000;
+    const size_t RECORDS = 1000000;
+    std::string directory = (std::filesystem::temp_directory_path() / "foodguard-bench-restart").string();
+
+    std::string feed;
+    std::mt19937 rng(42);
+    for (size_t i = 0; i < RECORDS; ++i) {
+        feed += "restaurant" + std::to_string(i * RESTAURANTS / RECORDS) + ",item" + std::to_string(rng() % 1000000)
+              + "," + std::to_string(1 + rng() % 50) + "," + std::to_string(1 + rng() % 14) + "\n";
+    }
+
+    std::cout << std::endl << "restart with " << RECORDS << " items" << std::endl;
+    for (bool snapshot : {false, true}) {
+        std::filesystem::remove_all(directory);
+        {
+            FoodApp app;
+            app.openDataDirectory(directory);
+            for (int r = 0; r < RESTAURANTS; ++r) {
+                app.registerUser(Restaurant("restaurant" + std::to_string(r), "pw"));
+            }
+            std::istringstream in(feed);
+            std::ostringstream report;
+            app.ingest(in, report);
+            if (snapshot) {
+                app.shutdown();
+            }
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        FoodApp restarted;
+        restarted.openDataDirectory(directory);
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+        std::cout << (snapshot ? "from snapshot:    " : "from log replay:  ") << elapsed.count() << " ms" << std::endl;
+    }
+    std::filesystem::remove_all(directory);
+}
+
+// Login lookup latency at 1M accounts: hashed directory vs the old linear scan
+void benchLogin() {
+    const size_t ACCOUNTS = 1000000;
+    const int LOOKUPS = 1000000;
+    const int SCAN_LOOKUPS = 100;
+
+    std::cout << std::endl << "login lookup with " << ACCOUNTS << " accounts" << std::endl;
+
+    UserDirectory directory;
+    std::vector<User> accounts;
+    accounts.reserve(ACCOUNTS);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < ACCOUNTS; ++i) {
+        std::string username = "user" + std::to_string(i);
+        directory.add(User(username, "pw" + std::to_string(i), "people"));
+        accounts.emplace_back(username, "pw" + std::to_string(i), "people");
+    }
+    auto signupTime = std::chrono::steady_clock::now() - start;
+
+    std::mt19937 rng(42);
+    std::vector<std::string> probes;
+    for (int i = 0; i < LOOKUPS; ++i) {
+        probes.push_back("user" + std::to_string(rng() % ACCOUNTS));
+    }
+
+    size_t hits = 0;
+    start = std::chrono::steady_clock::now();
+    for (const std::string& username : probes) {
+        const User* user = directory.find(username);
+        hits += user != nullptr && user->getPasswordHash().size() > 2;
+    }
+    auto directoryTime = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < SCAN_LOOKUPS; ++i) {
+        const std::string& username = probes[i];
+        auto it = std::find_if(accounts.begin(), accounts.end(), [&username](const User& user) {
+            return user.getUsername() == username;
+        });
+        hits += it != accounts.end();
+    }
+    auto scanTime = std::chrono::steady_clock::now() - start;
+
+    if (hits != static_cast<size_t>(LOOKUPS + SCAN_LOOKUPS)) {
+        std::cerr << "login lookups missed accounts" << std::endl;
+    }
+
+    auto nanos = [](std::chrono::steady_clock::duration d) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+    };
+    std::cout << "signup (directory):   " << nanos(signupTime) / static_cast<long long>(ACCOUNTS) << " ns/account" << std::endl;
+    std::cout << "login (directory):    " << nanos(directoryTime) / LOOKUPS << " ns/lookup" << std::endl;
+    std::cout << "login (linear scan):  " << nanos(scanTime) / SCAN_LOOKUPS << " ns/lookup" << std::endl;
+}
+
+// Per-request authentication: resolving a session token vs checking the password again
+void benchSessions() {
+    const int ACCOUNTS = 100000;
+    const int LOOKUPS = 1000000;
+
+    std::cout << std::endl << "session resolve vs credential check, " << ACCOUNTS << " logged-in accounts" << std::endl;
+
+    FoodApp app;
+    std::vector<SessionToken> tokens;
+    for (int i = 0; i < ACCOUNTS; ++i) {
+        app.registerUser(User("user" + std::to_string(i), "pw" + std::to_string(i), "people"));
+        tokens.push_back(app.openSession("user" + std::to_string(i), "pw" + std::to_string(i)));
+    }
+
+    std::mt19937 rng(42);
+    std::vector<int> probes;
+    for (int i = 0; i < LOOKUPS; ++i) {
+        probes.push_back(static_cast<int>(rng() % ACCOUNTS));
+    }
+    std::vector<std::pair<std::string, std::string>> credentials;
+    for (int i = 0; i < ACCOUNTS; ++i) {
+        credentials.emplace_back("user" + std::to_string(i), "pw" + std::to_string(i));
+    }
+
+    size_t hits = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int probe : probes) {
+        hits += app.resolveSession(tokens[probe]) == static_cast<UserId>(probe);
+    }
+    auto resolveTime = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int probe : probes) {
+        hits += app.authenticate(credentials[probe].first, credentials[probe].second) == static_cast<UserId>(probe);
+    }
+    auto authenticateTime = std::chrono::steady_clock::now() - start;
+
+    if (hits != static_cast<size_t>(LOOKUPS) * 2) {
+        std::cerr << "session lookups missed accounts" << std::endl;
+    }
+
+    auto nanos = [](std::chrono::steady_clock::duration d) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+    };
+    std::cout << "resolve session:      " << nanos(resolveTime) / LOOKUPS << " ns/request" << std::endl;
+    std::cout << "check credentials:    " << nanos(authenticateTime) / LOOKUPS << " ns/request" << std::endl;
+}
+
+// Cost of the per-command metrics on the single-threaded mixed session workload
+void benchMetricsOverhead() {
+    const int RESTAURANTS = 1000;
+    const int OPS = 300000;
+    const int ROUNDS = 5;
+
+    std::cout << std::endl << "metrics overhead, " << OPS << " mixed operations" << std::endl;
+
+    FoodApp app;
+    for (int r = 0; r < RESTAURANTS; ++r) {
+        app.registerUser(User("restaurant" + std::to_string(r), "pw", "restaurant"));
+    }
+    for (int i = 0; i < RESTAURANTS * 20; ++i) {
+        app.listFoodItem(static_cast<UserId>(i % RESTAURANTS), "item" + std::to_string(i), 1, 1 + i % 30);
+    }
+
+    auto workload = [&app]() {
+        std::mt19937 rng(42);
+        size_t seen = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < OPS; ++i) {
+            UserId restaurant = static_cast<UserId>(rng() % RESTAURANTS);
+            if (rng() % 2 == 0) {
+                PageCursor cursor;
+                seen += app.forEachFoodItem(restaurant, cursor, 20, [](const FoodItem&) {});
+            } else {
+                seen += app.authenticate("restaurant" + std::to_string(restaurant), "pw") != NO_USER;
+            }
+        }
+        if (seen == 0) {
+            std::cerr << "metrics workload read nothing" << std::endl;
+        }
+        return std::chrono::steady_clock::now() - start;
+    };
+
+    std::chrono::steady_clock::duration off = std::chrono::hours(1), on = std::chrono::hours(1);
+    for (int round = 0; round < ROUNDS; ++round) {
+        Metrics::enabled() = false;
+        off = std::min(off, workload());
+        Metrics::enabled() = true;
+        on = std::min(on, workload());
+    }
+
+    // The A/B difference is within run-to-run noise on small machines, so also time the instrumentation alone
+    const int TIMERS = 10000000;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < TIMERS; ++i) {
+        CommandTimer timer(VIEW_COMMAND);
+    }
+    auto timerTime = std::chrono::steady_clock::now() - start;
+
+    auto nanos = [](std::chrono::steady_clock::duration d) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+    };
+    double perCall = static_cast<double>(nanos(timerTime)) / TIMERS;
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "without metrics:      " << nanos(off) / OPS << " ns/op" << std::endl;
+    std::cout << "with metrics:         " << nanos(on) / OPS << " ns/op (" << 100.0 * (nanos(on) - nanos(off)) / nanos(off) << "% measured)" << std::endl;
+    std::cout << "instrumentation:      " << perCall << " ns/call (" << 100.0 * perCall * OPS / nanos(off) << "% of an operation)" << std::endl;
+    std::cout << std::defaultfloat;
+}
+
+// Sessions mixing reads (listing a restaurant, logging in) with 10% listings,
+// run on 1-8 worker threads against one in-memory app
+void benchConcurrentSessions() {
+    const int RESTAURANTS = 1000;
+    const int OPS_PER_THREAD = 200000;
+
+    std::cout << std::endl << "mixed sessions (90% reads, 10% listings), " << std::thread::hardware_concurrency() << " hardware threads" << std::endl;
+    std::cout << "threads        ops/s" << std::endl;
+
+    for (size_t threads : {1, 2, 4, 8}) {
+        FoodApp app;
+        for (int r = 0; r < RESTAURANTS; ++r) {
+            app.registerUser(User("restaurant" + std::to_string(r), "pw", "restaurant"));
+        }
+
+        std::atomic<size_t> reads(0);
+        auto start = std::chrono::steady_clock::now();
+        {
+            ThreadPool pool(threads);
+            for (size_t t = 0; t < threads; ++t) {
+                pool.submit([&app, &reads, t] {
+                    std::mt19937 rng(static_cast<unsigned>(42 + t));
+                    size_t seen = 0;
+                    for (int i = 0; i < OPS_PER_THREAD; ++i) {
+                        UserId restaurant = static_cast<UserId>(rng() % RESTAURANTS);
+                        unsigned kind = rng() % 10;
+                        if (kind == 0) {
+                            app.listFoodItem(restaurant, "item" + std::to_string(i), 1, 1 + static_cast<int>(rng() % 30));
+                        } else if (kind < 5) {
+                            PageCursor cursor;
+                            seen += app.forEachFoodItem(restaurant, cursor, 20, [](const FoodItem&) {});
+                        } else {
+                            seen += app.authenticate("restaurant" + std::to_string(restaurant), "pw") != NO_USER;
+                        }
+                    }
+                    reads += seen;
+                });
+            }
+            pool.waitIdle();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (reads.load() == 0) {
+            std::cerr << "mixed sessions read nothing" << std::endl;
+        }
+        std::cout << std::setw(7) << threads << std::setw(13) << static_cast<long long>(threads * OPS_PER_THREAD / seconds) << std::endl;
+    }
+}
+
+// Matching new listings against keyword alerts: the inverted index against checking every subscription
+void benchAlerts() {
+    const size_t PEOPLE = 200000;
+    const size_t KEYWORDS_EACH = 5;
+    const size_t VOCABULARY = 5000;
+    const int LISTINGS = 100000;
+    const int SCANNED_LISTINGS = 20;
+
+    std::cout << std::endl << "alert matching, " << PEOPLE * KEYWORDS_EACH << " subscriptions over " << VOCABULARY << " words" << std::endl;
+
+    std::mt19937 rng(42);
+    SubscriptionIndex index;
+    std::vector<std::vector<std::string>> keywordsOf(PEOPLE);
+    for (size_t person = 0; person < PEOPLE; ++person) {
+        for (size_t k = 0; k < KEYWORDS_EACH; ++k) {
+            std::string keyword = "word" + std::to_string(rng() % VOCABULARY);
+            if (index.subscribe(static_cast<UserId>(person), keyword)) {
+                keywordsOf[person].push_back(keyword);
+            }
+        }
+    }
+
+    std::vector<std::string> names;
+    for (int i = 0; i < LISTINGS; ++i) {
+        names.push_back("Word" + std::to_string(rng() % VOCABULARY) + "_word" + std::to_string(rng() % (VOCABULARY * 4)));
+    }
+
+    size_t matches = 0;
+    std::vector<UserId> matched;
+    auto start = std::chrono::steady_clock::now();
+    for (const std::string& name : names) {
+        index.match(name, matched);
+        matches += matched.size();
+    }
+    auto indexTime = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < SCANNED_LISTINGS; ++i) {
+        std::vector<std::string> words;
+        SubscriptionIndex::forEachWord(names[i], [&words](const std::string& word) {
+            words.push_back(word);
+        });
+        std::vector<UserId> scanned;
+        for (size_t person = 0; person < PEOPLE; ++person) {
+            for (const std::string& keyword : keywordsOf[person]) {
+                if (std::find(words.begin(), words.end(), keyword) != words.end()) {
+                    scanned.push_back(static_cast<UserId>(person));
+                    break;
+                }
+            }
+        }
+        index.match(names[i], matched);
+        if (scanned != matched) {
+            std::cerr << "alert index disagrees with a full scan for " << names[i] << std::endl;
+        }
+    }
+    auto scanTime = std::chrono::steady_clock::now() - start;
+
+    auto perListing = [](std::chrono::steady_clock::duration d, int count) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count() / count;
+    };
+    std::cout << "inverted index:  " << perListing(indexTime, LISTINGS) << " ns/listing (" << matches / LISTINGS << " subscribers matched on average)" << std::endl;
+    std::cout << "scan all:        " << perListing(scanTime, SCANNED_LISTINGS) << " ns/listing" << std::endl;
+}
+
+// Sweeping expired items in bounded batches: how long each batch holds a shard, and the memory handed back
+void benchSweep() {
+    const int RESTAURANTS = 1000;
+    const int ITEMS = 1000000;
+    const size_t BATCH = 4;
+
+    std::cout << std::endl << "expiry sweep of " << ITEMS << " items listed over 14 days, " << BATCH << " per batch" << std::endl;
+    std::cout << "swept days    items   items/s   batch p50 us   p99 us   max us   item chunks" << std::endl;
+
+    // Listed in arrival order, so expiry roughly follows handle order as it would in service
+    std::mt19937 rng(42);
+    time_t now = time(nullptr);
+    ShardedFoodStore store;
+    for (int i = 0; i < ITEMS; ++i) {
+        time_t expiresAt = now + static_cast<time_t>(i) * 14 * SECONDS_PER_DAY / ITEMS + static_cast<time_t>(rng() % SECONDS_PER_DAY);
+        store.insert(FoodItem("item" + std::to_string(rng() % 100000), 1, expiresAt, static_cast<UserId>(rng() % RESTAURANTS)));
+    }
+
+    for (int days : {7, 15}) {
+        std::vector<long long> batchNanos;
+        size_t removed = 0;
+        size_t batch;
+        auto start = std::chrono::steady_clock::now();
+        do {
+            auto batchStart = std::chrono::steady_clock::now();
+            batch = store.removeExpired(now + days * SECONDS_PER_DAY, BATCH, [](const FoodItem&) {});
+            batchNanos.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - batchStart).count());
+            removed += batch;
+        } while (batch == BATCH);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::sort(batchNanos.begin(), batchNanos.end());
+        auto micros = [&batchNanos](double quantile) {
+            return batchNanos[static_cast<size_t>(quantile * (batchNanos.size() - 1))] / 1000.0;
+        };
+        std::cout << std::setw(11) << days << std::setw(9) << removed << std::setw(10) << static_cast<long long>(removed / seconds)
+                  << std::fixed << std::setprecision(1) << std::setw(15) << micros(0.5) << std::setw(9) << micros(0.99) << std::setw(9) << micros(1.0)
+                  << std::defaultfloat << std::setw(14) << store.chunkCount() << std::endl;
+    }
+    if (store.size() != 0) {
+        std::cerr << "sweep left " << store.size() << " items" << std::endl;
+    }
+}
+
+// "Food near me" over 100k restaurants spread across a city: grid walk against checking every restaurant
+void benchNearby() {
+    const int RESTAURANTS = 100000;
+    const size_t K = 10;
+    const int QUERIES = 10000;
+    const int SCANNED_QUERIES = 50;
+    const double SOUTH = 40.5, WEST = -74.25, SPAN = 0.5; // About 55 x 42 km
+
+    std::cout << std::endl << "nearest " << K << " restaurants with stock among " << RESTAURANTS << std::endl;
+
+    FoodApp app;
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> offset(0, SPAN);
+    std::vector<std::pair<UserId, Location>> stocked;
+    for (int r = 0; r < RESTAURANTS; ++r) {
+        UserId id = app.registerUser(Restaurant("restaurant" + std::to_string(r), "pw"));
+        Location location{SOUTH + offset(rng), WEST + offset(rng)};
+        app.setLocation(id, location);
+        if (rng() % 4 != 0) { // A quarter have nothing listed right now
+            for (unsigned i = 0, items = 1 + rng() % 5; i < items; ++i) {
+                app.listFoodItem(id, "item" + std::to_string(rng() % 1000), 1, 1 + static_cast<int>(rng() % 14));
+            }
+            stocked.emplace_back(id, location);
+        }
+    }
+
+    std::vector<UserId> people;
+    for (int q = 0; q < 100; ++q) {
+        people.push_back(app.registerUser(User("person" + std::to_string(q), "pw", "people")));
+        app.setLocation(people.back(), Location{SOUTH + offset(rng), WEST + offset(rng)});
+    }
+
+    size_t found = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int q = 0; q < QUERIES; ++q) {
+        found += app.forEachNearby(people[q % people.size()], K, [](const User&, double, const FoodItem&) {});
+    }
+    auto gridTime = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    for (int q = 0; q < SCANNED_QUERIES; ++q) {
+        Location here{};
+        app.getLocation(people[q % people.size()], here);
+        std::vector<std::pair<double, UserId>> byDistance;
+        for (const auto& restaurant : stocked) {
+            byDistance.emplace_back(distanceKm(here, restaurant.second), restaurant.first);
+        }
+        std::partial_sort(byDistance.begin(), byDistance.begin() + K, byDistance.end());
+
+        std::vector<UserId> nearest;
+        app.forEachNearby(people[q % people.size()], K, [&nearest](const User& restaurant, double, const FoodItem&) {
+            nearest.push_back(restaurant.getId());
+        });
+        for (size_t i = 0; i < K; ++i) {
+            if (nearest.size() != K || nearest[i] != byDistance[i].second) {
+                std::cerr << "nearby search disagrees with a full scan" << std::endl;
+                break;
+            }
+        }
+    }
+    auto scanTime = std::chrono::steady_clock::now() - start;
+
+    if (found != K * QUERIES) {
+        std::cerr << "nearby search found " << found << " of " << K * QUERIES << " restaurants" << std::endl;
+    }
+    auto micros = [](std::chrono::steady_clock::duration d, int count) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(d).count() / static_cast<double>(count);
+    };
+    std::cout << "grid:        " << micros(gridTime, QUERIES) << " us/query" << std::endl;
+    std::cout << "scan all:    " << micros(scanTime, SCANNED_QUERIES) << " us/query" << std::endl;
+}
+
+// Waste report: copying the store into columns, then aggregating them, against one
+// pass over the live items; then the aggregation alone over 10M synthetic rows
+void benchWasteReport() {
+    const int RESTAURANTS = 10000;
+    const int ITEMS = 1000000;
+    const size_t ROWS = 10000000;
+    const size_t TOP = 10;
+
+    std::cout << std::endl << "waste report over " << ITEMS << " items" << std::endl;
+    std::mt19937 rng(42);
+    time_t now = time(nullptr);
+    ShardedFoodStore store;
+    for (int i = 0; i < ITEMS; ++i) {
+        time_t expiresAt = now + static_cast<time_t>(rng() % (16 * SECONDS_PER_DAY)) - 2 * SECONDS_PER_DAY;
+        store.insert(FoodItem("item" + std::to_string(rng() % 100000), 1 + static_cast<int>(rng() % 50), expiresAt, static_cast<UserId>(rng() % RESTAURANTS)));
+    }
+
+    auto millis = [](std::chrono::steady_clock::duration d) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(d).count() / 1000.0;
+    };
+    ThreadPool pool(ThreadPool::hardwareThreads());
+
+    auto start = std::chrono::steady_clock::now();
+    ItemColumns columns(now);
+    store.copyColumns(columns);
+    auto copied = std::chrono::steady_clock::now();
+    WasteReport report = WasteReport::aggregate(columns, pool, TOP);
+    auto aggregated = std::chrono::steady_clock::now();
+
+    // The same aggregates computed item by item while walking the store
+    std::vector<int64_t> byOwner(RESTAURANTS, 0);
+    std::unordered_map<std::string, int64_t> byName;
+    int64_t byDay[WasteReport::DAYS + 2] = {};
+    store.forEachByName([&](const FoodItem& item) {
+        time_t left = item.getExpiresAt() - now;
+        byDay[left <= 0 ? WasteReport::DAYS + 1 : std::min<time_t>((left - 1) / SECONDS_PER_DAY, WasteReport::DAYS)] += item.getQuantity();
+        byOwner[item.getOwnerId()] += item.getQuantity();
+        byName[item.getName()] += item.getQuantity();
+    });
+    std::vector<std::pair<int64_t, UserId>> topOwners;
+    for (UserId owner = 0; owner < byOwner.size(); ++owner) {
+        topOwners.emplace_back(byOwner[owner], owner);
+    }
+    std::partial_sort(topOwners.begin(), topOwners.begin() + TOP, topOwners.end(), [](const auto& a, const auto& b) {
+        return a.first > b.first || (a.first == b.first && a.second < b.second);
+    });
+    auto walked = std::chrono::steady_clock::now();
+
+    bool agrees = byDay[WasteReport::DAYS + 1] == report.expiredQuantity && report.topRestaurants.size() == TOP;
+    for (int d = 0; d <= WasteReport::DAYS; ++d) {
+        agrees = agrees && byDay[d] == report.expiringByDay[d];
+    }
+    for (size_t i = 0; agrees && i < TOP; ++i) {
+        agrees = topOwners[i] == report.topRestaurants[i];
+    }
+    for (const auto& item : report.topItems) {
+        agrees = agrees && byName[item.second] == item.first;
+    }
+    if (!agrees) {
+        std::cerr << "waste report disagrees with a walk over the items" << std::endl;
+    }
+    std::cout << "copy to columns:   " << millis(copied - start) << " ms" << std::endl;
+    std::cout << "aggregate columns: " << millis(aggregated - copied) << " ms" << std::endl;
+    std::cout << "walk the store:    " << millis(walked - aggregated) << " ms" << std::endl;
+
+    std::cout << std::endl << "waste report aggregation over " << ROWS << " rows" << std::endl;
+    ItemColumns wide(now);
+    wide.reserve(ROWS);
+    for (size_t i = 0; i < ROWS; ++i) {
+        time_t expiresAt = now + static_cast<time_t>(rng() % (16 * SECONDS_PER_DAY)) - 2 * SECONDS_PER_DAY;
+        wide.add("item" + std::to_string(i / 500), 1 + static_cast<int>(rng() % 50), expiresAt, static_cast<UserId>(rng() % 100000));
+    }
+    for (size_t threads : {size_t(1), static_cast<size_t>(std::thread::hardware_concurrency())}) {
+        ThreadPool workers(threads);
+        double best = 0;
+        for (int run = 0; run < 5; ++run) {
+            start = std::chrono::steady_clock::now();
+            WasteReport wideReport = WasteReport::aggregate(wide, workers, TOP);
+            double elapsed = millis(std::chrono::steady_clock::now() - start);
+            best = run == 0 ? elapsed : std::min(best, elapsed);
+            if (wideReport.rows != ROWS) {
+                std::cerr << "waste report saw " << wideReport.rows << " rows" << std::endl;
+            }
+        }
+        std::cout << std::setw(3) << threads << " threads: " << best << " ms" << std::endl;
+        if (threads == std::thread::hardware_concurrency()) {
+            break;
+        }
+    }
+}
+
+// Many people claiming one unit at a time from the same popular item, until it runs out
+void benchClaims() {
+    const int CLAIMS_PER_THREAD = 500000;
+
+    std::cout << std::endl << "claims on one popular item, " << std::thread::hardware_concurrency() << " hardware threads" << std::endl;
+    std::cout << "threads     claims/s" << std::endl;
+
+    time_t now = time(nullptr);
+    for (size_t threads : {1, 2, 4, 8}) {
+        ShardedFoodStore store;
+        const int stock = static_cast<int>(threads) * CLAIMS_PER_THREAD;
+        store.insert(FoodItem("bread", stock, now + SECONDS_PER_DAY, 0));
+        for (int i = 0; i < 100; ++i) {
+            store.insert(FoodItem("item" + std::to_string(i), 1, now + SECONDS_PER_DAY, 0));
+        }
+
+        std::atomic<long long> taken(0);
+        std::atomic<int> emptied(0);
+        auto start = std::chrono::steady_clock::now();
+        {
+            ThreadPool pool(threads);
+            for (size_t t = 0; t < threads; ++t) {
+                pool.submit([&store, &taken, &emptied, now] {
+                    long long mine = 0;
+                    for (int i = 0; i < CLAIMS_PER_THREAD; ++i) {
+                        Claim claim = store.claim(0, "bread", now, 1);
+                        mine += claim.taken;
+                        emptied += claim.emptied;
+                    }
+                    taken += mine;
+                });
+            }
+            pool.waitIdle();
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (taken.load() != stock || emptied.load() != 1 || store.size() != 100) {
+            std::cerr << "claims took " << taken.load() << " of " << stock << " units, emptied " << emptied.load()
+                      << " times, left " << store.size() << " items" << std::endl;
+        }
+        std::cout << std::setw(7) << threads << std::setw(13) << static_cast<long long>(stock / seconds) << std::endl;
+    }
+}
+
+#ifdef __linux__
+// Reads replies off a blocking client socket until count of them have arrived; returns the rows seen
+size_t readReplies(int fd, size_t count, std::string& buffer) {
+    size_t rows = 0;
+    size_t pendingRows = 0;
+    size_t parsed = 0;
+    while (count > 0 || pendingRows > 0) {
+        size_t newline = buffer.find('\n', parsed);
+        if (newline == std::string::npos) {
+            buffer.erase(0, parsed);
+            parsed = 0;
+            char chunk[65536];
+            ssize_t got = read(fd, chunk, sizeof(chunk));
+            if (got <= 0) {
+                throw std::runtime_error("server closed the connection");
+            }
+            buffer.append(chunk, static_cast<size_t>(got));
+            continue;
+        }
+        if (pendingRows > 0) {
+            --pendingRows;
+            ++rows;
+        } else {
+            if (buffer.compare(parsed, 3, "OK ") == 0) {
+                pendingRows = std::stoul(buffer.substr(parsed + 3, newline - parsed - 3));
+            }
+            --count;
+        }
+        parsed = newline + 1;
+    }
+    buffer.erase(0, parsed);
+    return rows;
+}
+
+// Opens a client connection to a line server on this machine; returns -1 if it cannot
+int connectLineClient(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        std::cerr << "cannot connect to the line server" << std::endl;
+        close(fd);
+        return -1;
+    }
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    return fd;
+}
+
+void sendAll(int fd, const std::string& requests) {
+    size_t sent = 0;
+    while (sent < requests.size()) {
+        ssize_t n = write(fd, requests.data() + sent, requests.size() - sent);
+        if (n <= 0) {
+            throw std::runtime_error("cannot send to the line server");
+        }
+        sent += static_cast<size_t>(n);
+    }
+}
+
+// Requests per second over localhost, one request per round trip and pipelined in batches
+void benchLineProtocol() {
+    const int REQUESTS = 100000;
+    const int ROUND_TRIPS = 20000;
+    const int BATCH = 1000;
+
+    std::cout << std::endl << "line protocol over 127.0.0.1" << std::endl;
+
+    FoodApp app;
+    UserId menu = app.registerUser(User("menu", "pw", "restaurant"));
+    for (int i = 0; i < 10; ++i) {
+        app.listFoodItem(menu, "dish" + std::to_string(i), 1, 1 + i);
+    }
+    LineServer server(app);
+    uint16_t port = server.listen(0);
+    server.start(2);
+
+    int fd = connectLineClient(port);
+    if (fd < 0) {
+        server.stop();
+        return;
+    }
+
+    std::string replies;
+    sendAll(fd, "SIGNUP bench pw restaurant\nLOGIN bench pw\n");
+    readReplies(fd, 2, replies);
+
+    // Nine lookups of a ten-item menu for every listing
+    auto request = [](int i) {
+        return i % 10 == 0 ? "ADD item" + std::to_string(i) + " 1 3\n" : std::string("LIST menu\n");
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ROUND_TRIPS; ++i) {
+        sendAll(fd, request(i % 20));
+        readReplies(fd, 1, replies);
+    }
+    double roundTripSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    std::string batch;
+    for (int i = 0; i < REQUESTS; i += BATCH) {
+        batch.clear();
+        for (int j = 0; j < BATCH; ++j) {
+            batch += request((i + j) % 20);
+        }
+        sendAll(fd, batch);
+        readReplies(fd, BATCH, replies);
+    }
+    double pipelinedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    sendAll(fd, "QUIT\n");
+    readReplies(fd, 1, replies);
+    close(fd);
+    server.stop();
+
+    std::cout << "one per round trip:   " << static_cast<long long>(ROUND_TRIPS / roundTripSeconds) << " requests/s" << std::endl;
+    std::cout << "pipelined by " << BATCH << ":     " << static_cast<long long>(REQUESTS / pipelinedSeconds) << " requests/s" << std::endl;
+}
+
+// Durable ADDs over localhost: pipelined, each synced to the log on its own, against
+// BATCH requests of the same size that share one sync
+void benchBatchedRequests() {
+    const int REQUESTS = 20000;
+    const int BATCH = 100;
+    std::string directory = (std::filesystem::temp_directory_path() / "foodguard-bench-batch").string();
+
+    std::cout << std::endl << "durable ADDs over 127.0.0.1, " << BATCH << " per round trip" << std::endl;
+
+    std::filesystem::remove_all(directory);
+    {
+        FoodApp app;
+        app.openDataDirectory(directory);
+        LineServer server(app);
+        uint16_t port = server.listen(0);
+        server.start(2);
+
+        int fd = connectLineClient(port);
+        if (fd < 0) {
+            server.stop();
+            std::filesystem::remove_all(directory);
+            return;
+        }
+
+        std::string replies;
+        sendAll(fd, "SIGNUP bench pw restaurant\nLOGIN bench pw\n");
+        readReplies(fd, 2, replies);
+
+        std::string requests;
+        for (bool batched : {false, true}) {
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < REQUESTS; i += BATCH) {
+                requests = batched ? "BATCH " + std::to_string(BATCH) + "\n" : std::string();
+                for (int j = 0; j < BATCH; ++j) {
+                    requests += "ADD item" + std::to_string((i + j) % 1000) + " 1 3\n";
+                }
+                sendAll(fd, requests);
+                readReplies(fd, batched ? 1 + BATCH : BATCH, replies);
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::cout << (batched ? "in BATCH requests: " : "pipelined:         ") << static_cast<long long>(REQUESTS / seconds) << " requests/s" << std::endl;
+        }
+
+        sendAll(fd, "QUIT\n");
+        readReplies(fd, 1, replies);
+        close(fd);
+        server.stop();
+    }
+    std::filesystem::remove_all(directory);
+}
+#endif
+
+// Inline bytes per record; owners and recipients are interned UserIds rather than embedded Users
+void reportFootprint() {
+    std::cout << "sizeof(User) = " << sizeof(User) << ", sizeof(FoodItem) = " << sizeof(FoodItem)
+              << ", sizeof(Notification) = " << sizeof(Notification) << std::endl << std::endl;
+}
+
+void runBenchmarks() {
+    reportFootprint();
+    benchOwnerIndex();
+    benchPaging();
+    benchRenderer();
+#ifdef FOODGUARD_COUNT_ALLOCATIONS
+    benchReadAllocations();
+#endif
+    benchNameIndex();
+    benchSearch();
+    benchAlerts();
+    benchNodePool();
+    benchIngest();
+    benchRestart();
+    benchLogin();
+    benchSessions();
+    benchConcurrentSessions();
+    benchClaims();
+    benchSweep();
+    benchNearby();
+    benchWasteReport();
+    benchMetricsOverhead();
+#ifdef __linux__
+    benchLineProtocol();
+    benchBatchedRequests();
+#endif
+}
+
+// Baseline suite for the core data paths, run with "--bench-suite [maxItems]".
+// Seeded synthetic datasets from 10k items / 1k users up to maxItems (default
+// 1M; 10M needs a few GB); every operation is timed on its own so the
+// p50/p99 columns are per-operation latencies.
+
+// Per-operation latencies of one measured path
+class LatencyRecorder {
+private:
+    std::vector<uint32_t> samples;
+    std::chrono::steady_clock::duration total{};
+
+public:
+    void record(std::chrono::steady_clock::duration elapsed) {
+        total += elapsed;
+        samples.push_back(static_cast<uint32_t>(std::min<long long>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), UINT32_MAX)));
+    }
+
+    template <typename Operation>
+    void time(Operation operation) {
+        auto start = std::chrono::steady_clock::now();
+        operation();
+        record(std::chrono::steady_clock::now() - start);
+    }
+
+    // Prints count, p50 and p99 latency and throughput; sorts the samples
+    void report(const char* label) {
+        if (samples.empty()) {
+            return;
+        }
+        std::sort(samples.begin(), samples.end());
+        double seconds = std::chrono::duration<double>(total).count();
+        std::cout << std::left << std::setw(22) << label << std::right << std::setw(10) << samples.size()
+                  << std::setw(11) << samples[samples.size() / 2] << std::setw(11) << samples[std::min(samples.size() - 1, samples.size() * 99 / 100)]
+                  << std::setw(14) << static_cast<long long>(samples.size() / std::max(seconds, 1e-9)) << std::endl;
+    }
+};
+
+// Peak resident set size of the process so far, in KiB (0 where unsupported)
+long peakRssKiB() {
+#if defined(_WIN32)
+    return 0;
+#else
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+void benchSuiteDataset(size_t itemCount, size_t userCount) {
+    const size_t QUERIES = 10000;
+    const size_t RESTAURANTS = std::max<size_t>(userCount / 10, 1);
+    const int MESSAGES_PER_USER = 4;
+
+    std::cout << std::endl << itemCount << " items, " << userCount << " users (" << RESTAURANTS << " restaurants)" << std::endl;
+    std::cout << "operation                  count    p50 ns    p99 ns         ops/s" << std::endl;
+
+    std::mt19937 rng(static_cast<unsigned>(itemCount));
+    time_t now = time(nullptr);
+
+    UserDirectory users;
+    LatencyRecorder signup;
+    for (size_t i = 0; i < userCount; ++i) {
+        User user("user" + std::to_string(i), "pw" + std::to_string(i), i < RESTAURANTS ? "restaurant" : "people");
+        signup.time([&] {
+            users.add(user);
+        });
+    }
+
+    LatencyRecorder login;
+    for (size_t i = 0; i < QUERIES; ++i) {
+        size_t account = rng() % userCount;
+        std::string username = "user" + std::to_string(account);
+        std::string password = "pw" + std::to_string(account);
+        login.time([&] {
+            const User* user = users.find(username);
+            if (user == nullptr || !user->checkPassword(password)) {
+                std::cerr << "login missed " << username << std::endl;
+            }
+        });
+    }
+
+    FoodItemBST store;
+    LatencyRecorder insert;
+    {
+        std::vector<FoodItem> items;
+        items.reserve(itemCount);
+        for (size_t i = 0; i < itemCount; ++i) {
+            items.emplace_back("item" + std::to_string(rng() % (itemCount * 4)), 1 + static_cast<int>(rng() % 50),
+                               now + static_cast<time_t>(rng() % (30 * 24)) * SECONDS_PER_HOUR, static_cast<UserId>(rng() % RESTAURANTS));
+        }
+        for (const FoodItem& item : items) {
+            insert.time([&] {
+                store.insert(item);
+            });
+        }
+    }
+
+    LatencyRecorder ownerList, ownerPage, expiring;
+    size_t rows = 0;
+    for (size_t i = 0; i < QUERIES; ++i) {
+        UserId owner = static_cast<UserId>(rng() % RESTAURANTS);
+        ownerList.time([&] {
+            rows += store.getFoodItems(owner).size();
+        });
+        ownerPage.time([&] {
+            PageCursor cursor;
+            rows += store.forEachFoodItem(owner, cursor, 20, [](const FoodItem&) {});
+        });
+    }
+    for (size_t i = 0; i < QUERIES / 10; ++i) {
+        time_t from = now + static_cast<time_t>(rng() % (29 * 24)) * SECONDS_PER_HOUR;
+        expiring.time([&] {
+            rows += store.getExpiringItems(from, from + SECONDS_PER_HOUR).size();
+        });
+    }
+
+    NotificationCenter notifications;
+    size_t recipients = std::min(userCount, QUERIES);
+    for (size_t i = 0; i < recipients; ++i) {
+        for (int m = 0; m < MESSAGES_PER_USER; ++m) {
+            notifications.send(Notification("item " + std::to_string(m) + " expires soon", static_cast<UserId>(i)));
+        }
+    }
+    LatencyRecorder drain;
+    for (size_t i = 0; i < recipients; ++i) {
+        drain.time([&] {
+            rows += notifications.drain(static_cast<UserId>(i), [](const Notification&) {});
+        });
+    }
+
+    if (rows == 0) {
+        std::cerr << "suite queries returned nothing" << std::endl;
+    }
+    insert.report("insert");
+    ownerList.report("getFoodItems");
+    ownerPage.report("owner page (20)");
+    expiring.report("expiring (1 hour)");
+    signup.report("signup");
+    login.report("login");
+    drain.report("drain (4 messages)");
+    std::cout << "peak RSS so far: " << peakRssKiB() / 1024 << " MiB" << std::endl;
+}
+
+void runBenchmarkSuite(size_t maxItems) {
+    reportFootprint();
+    for (size_t items = 10000; items <= maxItems; items *= 10) {
+        benchSuiteDataset(items, std::min<size_t>(std::max<size_t>(items / 10, 1000), 1000000));
+    }
+}
+
+// Self-tests, run with "--self-test". Unlike the benchmarks they only check: each
+// failure is printed, and any failure makes the run exit non-zero.
+int selfTestFailures = 0;
+
+void expect(bool passed, const std::string& what) {
+    if (!passed) {
+        std::cerr << "\033[1;31mFAIL: " << what << "\033[0m" << std::endl;
+        ++selfTestFailures;
+    }
+}
+
+// Ending NO_SESSION must not free a free slot a second time and hand it to two sessions
+void testSessionSlotReuse() {
+    SessionTable sessions(60);
+    time_t now = time(nullptr);
+    SessionToken x = sessions.issue(1, now);
+    SessionToken w = sessions.issue(2, now);
+    sessions.revoke(x);
+    sessions.revoke(w);
+    expect(sessions.resolve(NO_SESSION, now) == NO_USER, "NO_SESSION resolves to the user of a free slot");
+    SessionToken y = sessions.issue(3, now);
+    sessions.revoke(NO_SESSION);
+    SessionToken z = sessions.issue(4, now);
+    SessionToken a = sessions.issue(5, now);
+
+    expect(sessions.resolve(y, now) == 3 && sessions.resolve(z, now) == 4 && sessions.resolve(a, now) == 5, "sessions share a slot after revoke(NO_SESSION)");
+    expect(sessions.size() == 3, "3 live sessions counted as " + std::to_string(sessions.size()));
+    sessions.revoke(y);
+    expect(sessions.resolve(y & 0xffffff, now) == NO_USER, "a token without nonce bits resolves to a user");
+}
+
+// Linear complexity of a bit sequence (Berlekamp-Massey over GF(2)): the length of
+// the shortest linear feedback shift register that generates it. Random bits score
+// about half their length; a generator that is linear in its state, such as a
+// Mersenne Twister, never scores more than its state size.
+size_t linearComplexity(const std::vector<bool>& bits) {
+    const size_t n = bits.size();
+    const size_t words = n / 64 + 2;
+    std::vector<uint64_t> reversed(words * 2, 0); // Bit j is bits[n - 1 - j]
+    for (size_t j = 0; j < n; ++j) {
+        reversed[j / 64] |= uint64_t(bits[n - 1 - j]) << (j % 64);
+    }
+    std::vector<uint64_t> connection(words, 0), previous(words, 0), saved;
+    connection[0] = previous[0] = 1;
+    size_t length = 0;
+    size_t lastChange = 0; // One past the step that last changed length
+    for (size_t step = 0; step < n; ++step) {
+        // Discrepancy: connection[i] & bits[step - i] summed over i = 0..length
+        size_t offset = n - 1 - step;
+        uint64_t sum = 0;
+        for (size_t w = 0; w <= length / 64; ++w) {
+            size_t word = w + offset / 64, shift = offset % 64;
+            uint64_t window = reversed[word] >> shift | (shift == 0 ? 0 : reversed[word + 1] << (64 - shift));
+            sum ^= connection[w] & window;
+        }
+        if (__builtin_parityll(sum) == 0) {
+            continue;
+        }
+        saved = connection;
+        size_t by = step + 1 - lastChange; // connection ^= previous << by
+        for (size_t w = words; w-- > by / 64;) {
+            size_t from = w - by / 64, shift = by % 64;
+            connection[w] ^= previous[from] << shift | (shift == 0 || from == 0 ? 0 : previous[from - 1] >> (64 - shift));
+        }
+        if (2 * length <= step) {
+            length = step + 1 - length;
+            lastChange = step + 1;
+            previous.swap(saved);
+        }
+    }
+    return length;
+}
+
+// Session nonces must not follow from each other: tokens a client collects from its
+// own logins may not let it work out anyone else's
+void testSessionNonces() {
+    const size_t COUNT = 48000; // Twice a Mersenne Twister's state, with room to spare
+    SessionTable sessions(60);
+    time_t now = time(nullptr);
+    std::vector<SessionToken> tokens;
+    for (size_t i = 0; i < COUNT; ++i) {
+        tokens.push_back(sessions.issue(static_cast<UserId>(i), now));
+    }
+    std::vector<SessionToken> nonces;
+    for (SessionToken token : tokens) {
+        nonces.push_back(token >> 24);
+    }
+    std::sort(nonces.begin(), nonces.end());
+    expect(std::adjacent_find(nonces.begin(), nonces.end()) == nonces.end(), "two sessions got the same nonce");
+
+    for (size_t bit : {24, 43, 63}) {
+        std::vector<bool> bits;
+        for (SessionToken token : tokens) {
+            bits.push_back(token >> bit & 1);
+        }
+        size_t complexity = linearComplexity(bits);
+        expect(complexity + 100 > COUNT / 2, "token bit " + std::to_string(bit) + " follows a linear recurrence of length " + std::to_string(complexity));
+    }
+}
+
+// Units left on a restaurant's listings
+int stockOf(const FoodApp& app, UserId restaurantId) {
+    const size_t PAGE = 100;
+    int stock = 0;
+    PageCursor cursor;
+    while (app.forEachFoodItem(restaurantId, cursor, PAGE, [&stock](const FoodItem& item) {
+        stock += item.getQuantity();
+    }) == PAGE) {
+    }
+    return stock;
+}
+
+// Listings claimed while they are being added must replay to the same stock
+void testAddClaimReplay() {
+    const int ITEMS = 2000;
+    std::string directory = (std::filesystem::temp_directory_path() / "foodguard-test-add-claim").string();
+    std::filesystem::remove_all(directory);
+
+    int stock;
+    UserId restaurantId;
+    {
+        FoodApp app;
+        app.openDataDirectory(directory);
+        restaurantId = app.registerUser(Restaurant("bakery", "pw"));
+        UserId personId = app.registerUser(User("eater", "pw", "people"));
+        std::atomic<bool> adding(true);
+        std::thread adder([&] {
+            for (int i = 0; i < ITEMS; ++i) {
+                app.listFoodItem(restaurantId, "bread", 1, 1);
+            }
+            adding = false;
+        });
+        int claimed = 0;
+        while (adding) {
+            claimed += app.claimFoodItem(personId, "bakery", "bread", 1);
+        }
+        adder.join();
+        stock = stockOf(app, restaurantId);
+        expect(stock == ITEMS - claimed, std::to_string(ITEMS) + " listed and " + std::to_string(claimed) + " claimed but " + std::to_string(stock) + " left");
+    }
+
+    FoodApp restarted;
+    restarted.openDataDirectory(directory);
+    expect(stockOf(restarted, restaurantId) == stock, "replay left " + std::to_string(stockOf(restarted, restaurantId)) + " of " + std::to_string(stock) + " units");
+    std::filesystem::remove_all(directory);
+}
+
+// A logged claim names one item. If that item is short on replay, the rest must not
+// come out of a later-expiring item of the same name
+void testClaimReplayExact() {
+    std::string directory = (std::filesystem::temp_directory_path() / "foodguard-test-claim-replay").string();
+    std::filesystem::remove_all(directory);
+
+    UserId restaurantId;
+    time_t soonest = std::numeric_limits<time_t>::max();
+    {
+        FoodApp app;
+        app.openDataDirectory(directory);
+        restaurantId = app.registerUser(Restaurant("dairy", "pw"));
+        app.listFoodItem(restaurantId, "milk", 2, 1);
+        app.listFoodItem(restaurantId, "milk", 5, 3);
+        PageCursor cursor;
+        app.forEachFoodItem(restaurantId, cursor, 10, [&soonest](const FoodItem& item) {
+            soonest = std::min(soonest, item.getExpiresAt());
+        });
+        app.shutdown(); // Snapshots both items, so replay finds them in the store
+    }
+
+    // A claim of 3 from the item holding only 2, as a damaged or hand-edited log could hold
+    WriteAheadLog wal;
+    wal.open(directory + "/wal-1.log");
+    BinaryWriter record;
+    record.put(restaurantId);
+    record.put(int32_t(3));
+    record.put(static_cast<int64_t>(soonest));
+    record.putString("milk");
+    wal.append(WriteAheadLog::CLAIM, record);
+    wal.close();
+
+    std::ostringstream warnings;
+    std::streambuf* stderrBuffer = std::cerr.rdbuf(warnings.rdbuf());
+    FoodApp restarted;
+    restarted.openDataDirectory(directory);
+    std::cerr.rdbuf(stderrBuffer);
+    expect(stockOf(restarted, restaurantId) == 5, "replay took " + std::to_string(7 - stockOf(restarted, restaurantId)) + " units where the claimed item held 2");
+    expect(warnings.str().find("found only 2") != std::string::npos, "a short replayed claim was not reported");
+    std::filesystem::remove_all(directory);
+}
+
+// Every byte under directory, to look for what must not be stored
+std::string filesUnder(const std::string& directory) {
+    std::string bytes;
+    for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+        std::ifstream in(entry.path(), std::ios::binary);
+        bytes.append(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    return bytes;
+}
+
+// Passwords reach neither the log nor a snapshot, and ones logged before hashing
+// are rewritten as hashes on the next start
+void testPasswordHashes() {
+    std::array<uint8_t, 32> abc = sha256("abc");
+    expect(abc[0] == 0xba && abc[1] == 0x78 && abc[30] == 0x15 && abc[31] == 0xad, "SHA-256 of \"abc\" is wrong");
+    User first("one", "same password", "people"), second("two", "same password", "people");
+    expect(first.getPasswordHash() != second.getPasswordHash(), "equal passwords got equal hashes");
+    expect(first.checkPassword("same password") && !first.checkPassword("same passwore") && !first.checkPassword(""), "password check is wrong");
+
+    std::string directory = (std::filesystem::temp_directory_path() / "foodguard-test-passwords").string();
+    std::filesystem::remove_all(directory);
+    {
+        FoodApp app;
+        app.openDataDirectory(directory);
+        app.registerUser(User("snapshotted", "hunter2-snapshotted", "people"));
+        app.shutdown();
+    }
+    {
+        FoodApp app;
+        app.openDataDirectory(directory);
+        app.registerUser(User("logged", "hunter2-logged", "people"));
+    }
+    std::string stored = filesUnder(directory);
+    expect(stored.find("hunter2") == std::string::npos, "a password was written to disk");
+
+    // A signup as logged before passwords were hashed
+    WriteAheadLog wal;
+    wal.open(directory + "/wal-1.log");
+    BinaryWriter record;
+    record.putString("legacy");
+    record.putString("hunter2-legacy");
+    record.putString("people");
+    wal.append(WriteAheadLog::PLAINTEXT_SIGNUP, record);
+    wal.close();
+
+    FoodApp restarted;
+    restarted.openDataDirectory(directory);
+    expect(restarted.authenticate("logged", "hunter2-logged") != NO_USER && restarted.authenticate("snapshotted", "hunter2-snapshotted") != NO_USER &&
+               restarted.authenticate("legacy", "hunter2-legacy") != NO_USER,
+           "a restored user cannot log in");
+    expect(restarted.authenticate("logged", "hunter2-snapshotted") == NO_USER, "a restored user logs in with another's password");
+    expect(filesUnder(directory).find("hunter2") == std::string::npos, "a plaintext password stayed on disk after restart");
+    std::filesystem::remove_all(directory);
+}
+
+#ifndef _WIN32
+// A commit that fails must not be covered by a later one that succeeds: the failed
+// batch is gone, so its records may never be reported durable
+void testLogCommitFailure() {
+    std::string directory = (std::filesystem::temp_directory_path() / "foodguard-test-log-failure").string();
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    WriteAheadLog wal;
+    wal.open(directory + "/wal-0.log");
+
+    // A file size limit of 0 makes the first write fail with EFBIG, then lifting it lets writes through again
+    struct rlimit limit;
+    getrlimit(RLIMIT_FSIZE, &limit);
+    struct rlimit blocked = limit;
+    blocked.rlim_cur = 0;
+    void (*previous)(int) = signal(SIGXFSZ, SIG_IGN);
+    setrlimit(RLIMIT_FSIZE, &blocked);
+    BinaryWriter lost;
+    lost.put(uint32_t(1));
+    wal.append(WriteAheadLog::SIGNUP, lost);
+    bool failed = false;
+    try {
+        wal.commit();
+    } catch (const std::exception&) {
+        failed = true;
+    }
+    setrlimit(RLIMIT_FSIZE, &limit);
+    signal(SIGXFSZ, previous);
+    expect(failed, "a commit past the file size limit succeeded");
+
+    BinaryWriter later;
+    later.put(uint32_t(2));
+    wal.append(WriteAheadLog::SIGNUP, later);
+    failed = false;
+    try {
+        wal.commit();
+    } catch (const std::exception&) {
+        failed = true;
+    }
+    expect(failed, "a commit after a failed one reported the lost records durable");
+    try {
+        wal.close();
+    } catch (const std::exception&) {
+    }
+    std::filesystem::remove_all(directory);
+}
+#endif
+
+// Batches that folding reorders or merges ("Pie" before "apple", "Bread" and
+// "bread") must index the same as adding their items one by one
+void testSearchIndexBatch() {
+    const char* NAMES[] = {"Bread", "Pie", "apple pie", "bread", "breadsticks", "pie", "ripe apple"};
+    std::mt19937 rng(7);
+    std::vector<std::pair<std::string, ItemHandle>> named;
+    std::vector<std::pair<time_t, ItemHandle>> expiring;
+    for (ItemHandle handle = 0; handle < 200; ++handle) {
+        named.emplace_back(NAMES[rng() % 7], handle);
+    }
+    std::stable_sort(named.begin(), named.end(), [](const std::pair<std::string, ItemHandle>& a, const std::pair<std::string, ItemHandle>& b) {
+        return a.first < b.first;
+    });
+    for (const auto& entry : named) {
+        expiring.emplace_back(static_cast<time_t>(rng() % 50), entry.second);
+    }
+
+    NameSearchIndex single, batched;
+    for (size_t i = 0; i < named.size(); ++i) {
+        single.insert(named[i].first, expiring[i].first, named[i].second);
+    }
+    size_t half = named.size() / 2; // A second batch also merges into names already indexed
+    batched.insertBatch(std::vector<std::pair<std::string, ItemHandle>>(named.begin(), named.begin() + half), std::vector<std::pair<time_t, ItemHandle>>(expiring.begin(), expiring.begin() + half));
+    batched.insertBatch(std::vector<std::pair<std::string, ItemHandle>>(named.begin() + half, named.end()), std::vector<std::pair<time_t, ItemHandle>>(expiring.begin() + half, expiring.end()));
+
+    expect(single.distinctNames() == batched.distinctNames(), "batched search index has " + std::to_string(batched.distinctNames()) + " names, not " + std::to_string(single.distinctNames()));
+    for (const char* query : {"bread", "BREAD*", "pie", "Pie*", "apple", "ap*", "ip", "ead", "x"}) {
+        expect(single.search(query, 10, 1000) == batched.search(query, 10, 1000), std::string("batched search index answers \"") + query + "\" differently");
+    }
+}
+
+#ifdef FOODGUARD_COUNT_ALLOCATIONS
+// A pool makes one heap allocation per chunk of blocks, reuses freed blocks, and
+// frees every chunk when destroyed. Counts are read before expect builds its message.
+void testNodePoolAllocations() {
+    size_t chunks, built, reused, released;
+    {
+        NodePool pool(200);
+        size_t blocks = pool.chunkBlocks() * 7 / 2;
+        chunks = (blocks + pool.chunkBlocks() - 1) / pool.chunkBlocks();
+        std::vector<void*> live(blocks);
+        size_t allocated = threadAllocations;
+        for (void*& block : live) {
+            block = pool.allocate();
+        }
+        built = threadAllocations - allocated;
+        for (size_t i = 0; i < blocks; i += 2) {
+            pool.deallocate(live[i]);
+        }
+        for (size_t i = 0; i < blocks; i += 2) {
+            live[i] = pool.allocate();
+        }
+        reused = threadAllocations - allocated - built;
+        released = threadDeallocations;
+    }
+    released = threadDeallocations - released - 1; // Less the vector's buffer
+    expect(built == chunks, "pool blocks took " + std::to_string(built) + " heap allocations for " + std::to_string(chunks) + " chunks");
+    expect(reused == 0, "reallocating freed pool blocks made " + std::to_string(reused) + " heap allocations");
+    expect(released == chunks, "destroying the pool freed " + std::to_string(released) + " of " + std::to_string(chunks) + " chunks");
+
+    // A tree's nodes come from its two pools: no heap call per node, and teardown returns them all
+    const size_t KEYS = 100000;
+    size_t allocated = threadAllocations;
+    auto* tree = new BPlusTree<uint64_t, size_t>();
+    std::mt19937_64 rng(42);
+    for (size_t i = 0; i < KEYS; ++i) {
+        tree->insert(rng(), i);
+    }
+    built = threadAllocations - allocated;
+    size_t nodes = tree->nodeCount();
+    chunks = tree->heapAllocations();
+    released = threadDeallocations;
+    delete tree;
+    released = threadDeallocations - released;
+    expect(built == 1 + chunks && chunks * 100 < nodes, std::to_string(nodes) + " tree nodes took " + std::to_string(built) + " heap allocations; its pools counted " + std::to_string(chunks));
+    expect(released == built, "tree teardown freed " + std::to_string(released) + " of " + std::to_string(built) + " heap allocations");
+}
+
+// Paging through listings with a warmed-up renderer allocates nothing per page or
+// per item; the only allocation is each fresh cursor copying its first name
+void testReadAllocations() {
+    const size_t PAGE_SIZES[] = {1, 100, 1000};
+    ReadAllocationFixture fixture(20, 2000);
+    for (bool expiring : {false, true}) {
+        for (const auto& format : RENDER_FORMATS) {
+            ItemRenderer renderer(format.second, expiring ? ItemRenderer::EXPIRING_ITEMS : ItemRenderer::OWNED_ITEMS);
+            fixture.walk(expiring, renderer, PAGE_SIZES[2]);
+            for (size_t pageRows : PAGE_SIZES) {
+                size_t before = threadAllocations;
+                std::pair<size_t, size_t> walked = fixture.walk(expiring, renderer, pageRows);
+                size_t allocations = threadAllocations - before;
+                expect(allocations <= fixture.listings(expiring), std::string(expiring ? "expiring " : "owner ") + format.first + " listings, " + std::to_string(pageRows) + " rows a page: " +
+                       std::to_string(allocations) + " allocations for " + std::to_string(walked.first) + " pages of " + std::to_string(walked.second) + " items");
+            }
+        }
+    }
+}
+#endif
+
+int runSelfTests() {
+    testSessionSlotReuse();
+    testSessionNonces();
+    testAddClaimReplay();
+    testClaimReplayExact();
+    testPasswordHashes();
+#ifndef _WIN32
+    testLogCommitFailure();
+#endif
+    testSearchIndexBatch();
+#ifdef FOODGUARD_COUNT_ALLOCATIONS
+    testNodePoolAllocations();
+    testReadAllocations();
+#else
+    std::cout << "skipped the heap allocation checks; they need a build with -DFOODGUARD_COUNT_ALLOCATIONS" << std::endl;
+#endif
+    if (selfTestFailures > 0) {
+        std::cerr << selfTestFailures << " self-test checks failed" << std::endl;
+        return 1;
+    }
+    std::cout << "all self-tests passed" << std::endl;
+    return 0;
+}
+
+#ifdef __linux__
+LineServer* servingServer = nullptr;
+
+void stopServing(int) {
+    if (servingServer != nullptr) {
+        servingServer->requestStop();
+    }
+}
+#endif
+
+int main(int argc, char* argv[]) {
+    std::string dataDirectory; // In memory unless --data names a directory
+    std::string ingestPath;
+    int servePort = -1;
+    bool report = false;
+    OutputFormat outputFormat = PLAIN_OUTPUT;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--bench") {
+            runBenchmarks();
+            return 0;
+        } else if (arg == "--bench-suite") {
+            std::string maxItems = i + 1 < argc ? argv[i + 1] : "1000000";
+            if (maxItems.empty() || maxItems.size() > 9 || maxItems.find_first_not_of("0123456789") != std::string::npos) {
+                std::cerr << "Invalid item count " << maxItems << std::endl;
+                return 1;
+            }
+            runBenchmarkSuite(std::stoul(maxItems));
+            return 0;
+        } else if (arg == "--self-test") {
+            return runSelfTests();
+        } else if (arg == "--ingest" && i + 1 < argc) {
+            ingestPath = argv[++i];
+        } else if (arg == "--data" && i + 1 < argc) {
+            dataDirectory = argv[++i];
+        } else if (arg == "--report") {
+            report = true;
+        } else if (arg == "--in-memory") {
+            dataDirectory.clear();
+        } else if (arg == "--format" && i + 1 < argc) {
+            std::string format = argv[++i];
+            if (format == "plain") {
+                outputFormat = PLAIN_OUTPUT;
+            } else if (format == "json") {
+                outputFormat = JSON_OUTPUT;
+            } else if (format == "columnar") {
+                outputFormat = COLUMNAR_OUTPUT;
+            } else {
+                std::cerr << "Unknown format " << format << " (use plain, json or columnar)" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--serve" && i + 1 < argc) {
+            std::string port = argv[++i];
+            servePort = port.size() <= 5 && port.find_first_not_of("0123456789") == std::string::npos ? std::stoi(port) : -1;
+            if (servePort < 0 || servePort > 65535) {
+                std::cerr << "Invalid port " << port << std::endl;
+                return 1;
+            }
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--data <dir> | --in-memory] [--ingest <file>] [--serve <port> | --report] [--format plain|json|columnar] | --bench | --bench-suite [maxItems] | --self-test" << std::endl;
+            return 1;
         }
     }
-};
 
-int main() {
     FoodApp app;
+    app.setOutputFormat(outputFormat);
+
+#ifndef _WIN32
+    // SIGUSR1 dumps the metrics to stderr. It is blocked before any other thread
+    // starts, so every thread inherits the mask and only the waiter receives it.
+    sigset_t dumpSignal;
+    sigemptyset(&dumpSignal);
+    sigaddset(&dumpSignal, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &dumpSignal, nullptr);
+    std::thread([&app, dumpSignal] {
+        int signal;
+        while (sigwait(&dumpSignal, &signal) == 0) {
+            app.dumpMetrics(std::cerr);
+        }
+    }).detach();
+#endif
+    try {
+        if (!dataDirectory.empty()) {
+            app.openDataDirectory(dataDirectory);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "\033[1;31mError: " << e.what() << "\033[0m" << std::endl;
+        return 1;
+    }
+
+    if (!ingestPath.empty()) {
+        std::ifstream feed(ingestPath);
+        if (!feed) {
+            std::cerr << "Cannot open " << ingestPath << std::endl;
+            return 1;
+        }
+        app.ingest(feed, std::cout);
+    }
+    if (report) {
+        app.writeWasteReport(std::cout);
+        return 0;
+    }
+    app.startSweeper();
+
+    if (servePort >= 0) {
+#ifdef __linux__
+        LineServer server(app);
+        try {
+            uint16_t port = server.listen(static_cast<uint16_t>(servePort));
+            std::cout << "Serving on 127.0.0.1:" << port << std::endl;
+        } catch (const std::exception& e) {
+            std::cerr << "\033[1;31mError: " << e.what() << "\033[0m" << std::endl;
+            return 1;
+        }
+        servingServer = &server;
+        signal(SIGINT, stopServing);
+        signal(SIGTERM, stopServing);
+        server.start(std::thread::hardware_concurrency());
+        server.join();
+        servingServer = nullptr;
+        app.shutdown();
+        return 0;
+#else
+        std::cerr << "--serve is only available on Linux" << std::endl;
+        return 1;
+#endif
+    }
     app.run();
     return 0;
 }